@@ -96,6 +96,8 @@
 #include "jit/jit_code_cache.h"
 #include "jni/java_vm_ext.h"
 #include "jni/jni_internal.h"
+#include "jni_member_index.h"
+#include "jni_trace.h"
 #include "linear_alloc.h"
 #include "mirror/array-alloc-inl.h"
 #include "mirror/array-inl.h"
@@ -465,29 +467,6 @@ ClassLinker::VisiblyInitializedCallback* ClassLinker::MarkClassInitialized(
   }
 }
 
-//add
-int dl_iterate_callback(struct dl_phdr_info* info, size_t , void* data) {
-    uintptr_t addr = reinterpret_cast<uintptr_t>(*(void**)data);
-    void* endptr=  (void*)(info->dlpi_addr + info->dlpi_phdr[info->dlpi_phnum - 1].p_vaddr + info->dlpi_phdr[info->dlpi_phnum - 1].p_memsz);
-    uintptr_t end=reinterpret_cast<uintptr_t>(endptr);
-    //ALOGD("[ROM] native: %p\n", (void*)addr);
-    //ALOGD("[ROM] Library name: %s\n", info->dlpi_name);
-    //ALOGD("[ROM] Library base address: %p\n", (void*) info->dlpi_addr);
-    //ALOGD("[ROM] Library end address: %p\n\n",endptr);
-    if(addr >= info->dlpi_addr && addr<=end){
-        //ALOGD("[ROM] Library found address: %p\n\n",(void*)info->dlpi_addr);
-        reinterpret_cast<void**>(data)[0] = reinterpret_cast<void*>(info->dlpi_addr);
-    }
-    return 0;
-}
-
-void* FindLibraryBaseAddress(void* entry_addr) {
-    void* lib_base_addr = entry_addr;
-    dl_iterate_phdr(dl_iterate_callback, &lib_base_addr);
-    return lib_base_addr;
-}
-//addend
-
 const void* ClassLinker::RegisterNative(
     Thread* self, ArtMethod* method, const void* native_method) {
   CHECK(method->IsNative()) << method->PrettyMethod();
@@ -515,13 +494,18 @@ const void* ClassLinker::RegisterNative(
     method->SetEntryPointFromJni(new_native_method);
   }
   // add
-  if(Runtime::Current()->GetConfigItem().isRegisterNativePrint){
-      void * native_ptr=new_native_method;
-      void* base_addr=FindLibraryBaseAddress(native_ptr);
-      uintptr_t native_data = reinterpret_cast<uintptr_t>(native_ptr);
-      uintptr_t base_data = reinterpret_cast<uintptr_t>(base_addr);
-      uintptr_t offset=native_data-base_data;
-      ALOGD("[ROM] ClassLinker::RegisterNative %s native_ptr:%p method_idx:0x%x offset:%p",method->PrettyMethod().c_str(),new_native_method,method->GetMethodIndex(),(void*)offset);
+  if(Runtime::Current()->GetConfigItem()->isRegisterNativePrint){
+      uintptr_t native_data = reinterpret_cast<uintptr_t>(new_native_method);
+      const JniTraceModule* module = JniTraceModuleIndex::Find(native_data);
+      uintptr_t offset = module != nullptr ? native_data - module->load_bias : 0u;
+      JniTrace::Print("[ROM] ClassLinker::RegisterNative %s native_ptr:%p method_idx:0x%x offset:%p module:%s",method->PrettyMethod().c_str(),new_native_method,method->GetMethodIndex(),(void*)offset,module != nullptr ? module->name.c_str() : "?");
+      JniTrace::RecordRegisterNative(method,new_native_method);
+  }
+  if(JniTrace::HasTrigger(JniTraceTriggers::kRegisterNative)){
+      JniTrace::CheckTrigger(JniTraceTriggers::kRegisterNative,method->PrettyMethod());
+  }
+  if(Runtime::Current()->GetConfigItem()->isJNIMethodPrint){
+      JniTraceMethodFilter::Prime(method);
   }
   // addend
     return new_native_method;
@@ -2403,6 +2387,11 @@ void ClassLinker::DeleteClassLoader(Thread* self, const ClassLoaderData& data, b
       }
     }
   }
+  // add
+  JniMemberIndex::RemoveIn(*data.allocator);
+  JniClassIndex::RemoveIn(*data.allocator);
+  JniTrace::OnClassLoaderUnloaded();
+  // addend
 
   delete data.allocator;
   delete data.class_table;
@@ -9895,6 +9884,13 @@ void ClassLinker::DumpForSigQuit(std::ostream& os) {
   Runtime* runtime = Runtime::Current();
   os << "Classes initialized: " << runtime->GetStat(KIND_GLOBAL_CLASS_INIT_COUNT) << " in "
      << PrettyDuration(runtime->GetStat(KIND_GLOBAL_CLASS_INIT_TIME)) << "\n";
+  // add
+  if(runtime->GetConfigItem()->isJNIMethodPrint){
+      JniTrace::DumpLatency(os);
+  }
+  JniTraceFlightRecorder::Checkpoint(os);
+  JniClassIndex::Dump(os);
+  // addend
 }
 
 class CountClassesVisitor : public ClassLoaderVisitor {
@@ -10186,6 +10182,10 @@ void ClassLinker::CleanupClassLoaders() {
         ++it;
       } else {
         VLOG(class_linker) << "Freeing class loader";
+        // add
+        // Before the lock is released, see JniTrace::OnClassLoaderUnloaded.
+        JniTrace::OnClassLoaderUnloaded();
+        // addend
         to_delete.push_back(data);
         it = class_loaders_.erase(it);
       }
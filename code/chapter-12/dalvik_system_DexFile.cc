@@ -925,11 +925,60 @@ static void DexFile_InvokeMethod(JNIEnv* env, jclass,jobject method,jboolean isD
   return;
 }
 
+static std::string GetStringField(JNIEnv* env, jobject item, jfieldID field) {
+    ScopedLocalRef<jstring> value(env, reinterpret_cast<jstring>(env->GetObjectField(item, field)));
+    if (value == nullptr) {
+        return std::string();
+    }
+    ScopedUtfChars chars(env, value.get());
+    return chars.c_str() != nullptr ? std::string(chars.c_str()) : std::string();
+}
+
+// The sampling fields and everything after them are newer than the framework side of
+// PackageItem, an absent field keeps the default of PackageItem.
+static jfieldID GetOptionalFieldID(JNIEnv* env, jclass klass, const char* name, const char* sig) {
+    jfieldID field = env->GetFieldID(klass, name, sig);
+    if (field == nullptr) {
+        env->ExceptionClear();
+    }
+    return field;
+}
+
+static void GetOptionalIntField(JNIEnv* env, jclass klass, jobject item, const char* name,
+                                int* value) {
+    jfieldID field = GetOptionalFieldID(env, klass, name, "I");
+    if (field != nullptr) {
+        *value = env->GetIntField(item, field);
+    }
+}
+
+static void GetOptionalBooleanField(JNIEnv* env, jclass klass, jobject item, const char* name,
+                                    bool* value) {
+    jfieldID field = GetOptionalFieldID(env, klass, name, "Z");
+    if (field != nullptr) {
+        *value = env->GetBooleanField(item, field);
+    }
+}
+
+static void GetOptionalStringField(JNIEnv* env, jclass klass, jobject item, const char* name,
+                                   std::string* value) {
+    jfieldID field = GetOptionalFieldID(env, klass, name, "Ljava/lang/String;");
+    if (field != nullptr) {
+        *value = GetStringField(env, item, field);
+    }
+}
+
 static void
 DexFile_initConfig(JNIEnv* env, jobject ,jobject item) {
 
     Runtime* runtime=Runtime::Current();
-    jclass jcInfo = env->FindClass("java/krom/PackageItem");
+    // Runtime::SetProcessPackageName already applied the config file natively, before any app
+    // code ran. Only frameworks that still parse the file in Java get this far.
+    if (runtime->GetConfigItem().Get()->version != 0u) {
+        return;
+    }
+    ScopedLocalRef<jclass> jcInfoRef(env, env->GetObjectClass(item));
+    jclass jcInfo = jcInfoRef.get();
     jfieldID jPackageName = env->GetFieldID(jcInfo, "packageName", "Ljava/lang/String;");
     jfieldID jJniModuleName = env->GetFieldID(jcInfo, "jniModuleName", "Ljava/lang/String;");
     jfieldID jJniFuncName = env->GetFieldID(jcInfo, "jniFuncName", "Ljava/lang/String;");
@@ -938,47 +987,25 @@ DexFile_initConfig(JNIEnv* env, jobject ,jobject item) {
 
     PackageItem citem;
 
-    jstring jstrPackageName = (jstring)env->GetObjectField(item, jPackageName);
-    const char* pPackageName = (char*)env->GetStringUTFChars(jstrPackageName, 0);
-    strcpy(citem.packageName, pPackageName);
-
-    jstring jstrJniModuleName = (jstring)env->GetObjectField(item, jJniModuleName);
-    const char* pJniModuleName = (char*)env->GetStringUTFChars(jstrJniModuleName, 0);
-    strcpy(citem.jniModuleName, pJniModuleName);
-
-    jstring jstrJniFuncName = (jstring)env->GetObjectField(item, jJniFuncName);
-    const char* pJniFuncName = (char*)env->GetStringUTFChars(jstrJniFuncName, 0);
-    strcpy(citem.jniFuncName, pJniFuncName);
+    citem.packageName = GetStringField(env, item, jPackageName);
+    citem.jniModuleName = GetStringField(env, item, jJniModuleName);
+    citem.jniFuncName = GetStringField(env, item, jJniFuncName);
 
     citem.isRegisterNativePrint = env->GetBooleanField(item, jIsRegisterNativePrint);
     citem.isJNIMethodPrint = env->GetBooleanField(item, jIsJNIMethodPrint);
-    if(citem.isJNIMethodPrint){
-        void* handle_xdl=NULL;
-        void* handle_xunwind=NULL;
-        void* handle_kbacktrace=NULL;
-        #if defined(__aarch64__)
-                // 当前 CPU 架构为 arm64
-            handle_xdl= dlopen("/system/lib64/libxdl.so",RTLD_NOW);
-            handle_xunwind= dlopen("/system/lib64/libxunwind.so",RTLD_NOW);
-            handle_kbacktrace= dlopen("/system/lib64/libkbacktrace.so",RTLD_NOW);
-        #else
-            // 当前 CPU 架构为 armeabi-v7a 或更早版本
-            handle_xdl= dlopen("/system/lib/libxdl.so",RTLD_NOW);
-            handle_xunwind= dlopen("/system/lib/libxunwind.so",RTLD_NOW);
-            handle_kbacktrace= dlopen("/system/lib/libkbacktrace.so",RTLD_NOW);
-        #endif
-        if(handle_kbacktrace!=nullptr){
-            citem.kbacktrace= dlsym(handle_kbacktrace, "_Z10kbacktracebPKc");
-            if(citem.kbacktrace==nullptr){
-                ALOGD("[ROM] kbacktrace is null.err:%s",dlerror());
-            }else{
-                ALOGD("[ROM] kbacktrace:%p.",citem.kbacktrace);
-            }
-        }else{
-            ALOGD("[ROM] handle_kbacktrace is null.err:%s",dlerror());
-        }
-    }
+    GetOptionalIntField(env, jcInfo, item, "sampleFirst", &citem.sampleFirst);
+    GetOptionalIntField(env, jcInfo, item, "sampleEvery", &citem.sampleEvery);
+    GetOptionalIntField(env, jcInfo, item, "maxEventsPerSecond", &citem.maxEventsPerSecond);
+    GetOptionalStringField(env, jcInfo, item, "traceSink", &citem.traceSink);
+    GetOptionalBooleanField(env, jcInfo, item, "drainToFile", &citem.drainToFile);
+    GetOptionalIntField(env, jcInfo, item, "flightRecorderMB", &citem.flightRecorderMB);
+    GetOptionalStringField(env, jcInfo, item, "triggers", &citem.triggers);
+    GetOptionalIntField(env, jcInfo, item, "triggerWindowMs", &citem.triggerWindowMs);
+    GetOptionalIntField(env, jcInfo, item, "preTriggerKB", &citem.preTriggerKB);
+    GetOptionalIntField(env, jcInfo, item, "maxOverheadPercent", &citem.maxOverheadPercent);
     runtime->SetConfigItem(citem);
+    // Later edits of the config file apply without restarting the app.
+    JniTraceConfig::StartWatcher(citem.packageName);
 }
 
 
@@ -1039,6 +1066,15 @@ static JNINativeMethod gMethods[] = {
 
 void register_dalvik_system_DexFile(JNIEnv* env) {
   REGISTER_NATIVE_METHODS("dalvik/system/DexFile");
+  // add
+  // The main thread is attached by now, tracing asked for on the command line can start.
+  JniTraceConfig::PublishLaunchOptions();
+  // Runs once while the zygote boots, its children then pick their jnitrace config without
+  // reading the file again.
+  if (Runtime::Current()->IsZygote()) {
+      JniTraceConfig::Preload();
+  }
+  //endadd
 }
 
 }  // namespace art
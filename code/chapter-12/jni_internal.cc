@@ -44,6 +44,8 @@
 #include "interpreter/interpreter.h"
 #include "java_vm_ext.h"
 #include "jni_env_ext.h"
+#include "jni_member_index.h"
+#include "jni_utf.h"
 #include "jvalue-inl.h"
 #include "mirror/class-alloc-inl.h"
 #include "mirror/class-inl.h"
@@ -405,12 +407,19 @@ ArtMethod* FindMethodJNI(const ScopedObjectAccess& soa,
   if (c == nullptr) {
     return nullptr;
   }
-  ArtMethod* method = nullptr;
+  ArtMethod* method = JniMemberIndex::LookupMethod(c, name, sig);
   auto pointer_size = Runtime::Current()->GetClassLinker()->GetImagePointerSize();
-  if (c->IsInterface()) {
-    method = c->FindInterfaceMethod(name, sig, pointer_size);
+  if (method != nullptr) {
+    // Searched before; the access checks below still depend on the caller.
   } else {
-    method = c->FindClassMethod(name, sig, pointer_size);
+    if (c->IsInterface()) {
+      method = c->FindInterfaceMethod(name, sig, pointer_size);
+    } else {
+      method = c->FindClassMethod(name, sig, pointer_size);
+    }
+    if (method != nullptr) {
+      JniMemberIndex::InsertMethod(c, name, sig, method);
+    }
   }
   if (method != nullptr &&
       ShouldDenyAccessToMember(method, soa.Self(), hiddenapi::AccessMethod::kNone)) {
@@ -447,10 +456,12 @@ ArtField* FindFieldJNI(const ScopedObjectAccess& soa,
   if (c == nullptr) {
     return nullptr;
   }
-  ArtField* field = nullptr;
+  ArtField* field = JniMemberIndex::LookupField(c.Get(), is_static, name, sig);
   ObjPtr<mirror::Class> field_type;
   ClassLinker* class_linker = Runtime::Current()->GetClassLinker();
-  if (UNLIKELY(sig[0] == '\0')) {
+  if (field != nullptr) {
+    // Searched before; its type was resolved then.
+  } else if (UNLIKELY(sig[0] == '\0')) {
     DCHECK(field == nullptr);
   } else if (sig[1] != '\0') {
     Handle<mirror::ClassLoader> class_loader(hs.NewHandle(c->GetClassLoader()));
@@ -458,7 +469,7 @@ ArtField* FindFieldJNI(const ScopedObjectAccess& soa,
   } else {
     field_type = class_linker->FindPrimitiveClass(*sig);
   }
-  if (field_type == nullptr) {
+  if (field == nullptr && field_type == nullptr) {
     // Failed to find type from the signature of the field.
     DCHECK(sig[0] == '\0' || soa.Self()->IsExceptionPending());
     StackHandleScope<1> hs2(soa.Self());
@@ -475,11 +486,16 @@ ArtField* FindFieldJNI(const ScopedObjectAccess& soa,
     return nullptr;
   }
   std::string temp;
-  if (is_static) {
-    field = mirror::Class::FindStaticField(
-        soa.Self(), c.Get(), name, field_type->GetDescriptor(&temp));
-  } else {
-    field = c->FindInstanceField(name, field_type->GetDescriptor(&temp));
+  if (field == nullptr) {
+    if (is_static) {
+      field = mirror::Class::FindStaticField(
+          soa.Self(), c.Get(), name, field_type->GetDescriptor(&temp));
+    } else {
+      field = c->FindInstanceField(name, field_type->GetDescriptor(&temp));
+    }
+    if (field != nullptr) {
+      JniMemberIndex::InsertField(c.Get(), is_static, name, sig, field);
+    }
   }
   if (field != nullptr && ShouldDenyAccessToMember(field, soa.Self())) {
     field = nullptr;
@@ -595,16 +611,23 @@ class JNI {
 
     Runtime* runtime = Runtime::Current();
     ClassLinker* class_linker = runtime->GetClassLinker();
-    std::string descriptor(NormalizeJniClassDescriptor(name));
     ScopedObjectAccess soa(env);
-    ObjPtr<mirror::Class> c = nullptr;
+    StackHandleScope<1> hs(soa.Self());
+    Handle<mirror::ClassLoader> class_loader(hs.NewHandle(
+        runtime->IsStarted() ? GetClassLoader<kEnableIndexIds>(soa) : nullptr));
+    ObjPtr<mirror::Class> c = JniClassIndex::Lookup(class_loader.Get(), name);
+    if (c != nullptr) {
+      return soa.AddLocalReference<jclass>(c);
+    }
+    std::string descriptor(NormalizeJniClassDescriptor(name));
     if (runtime->IsStarted()) {
-      StackHandleScope<1> hs(soa.Self());
-      Handle<mirror::ClassLoader> class_loader(hs.NewHandle(GetClassLoader<kEnableIndexIds>(soa)));
       c = class_linker->FindClass(soa.Self(), descriptor.c_str(), class_loader);
     } else {
       c = class_linker->FindSystemClass(soa.Self(), descriptor.c_str());
     }
+    if (c != nullptr) {
+      JniClassIndex::Insert(class_loader.Get(), name, c);
+    }
     return soa.AddLocalReference<jclass>(c);
   }
 
@@ -920,7 +943,6 @@ class JNI {
     CHECK_NON_NULL_ARGUMENT(sig);
     ScopedObjectAccess soa(env);
     jmethodID result = FindMethodID<kEnableIndexIds>(soa, java_class, name, sig, false);
-    ShowVarArgs(soa,__FUNCTION__,java_class,name,sig,result);
     return result;
   }
 
@@ -941,7 +963,6 @@ class JNI {
     CHECK_NON_NULL_ARGUMENT(mid);
     ScopedObjectAccess soa(env);
     JValue result(InvokeVirtualOrInterfaceWithVarArgs(soa, obj, mid, ap));
-    ShowVarArgs(soa,__FUNCTION__,mid,ap);
     return soa.AddLocalReference<jobject>(result.GetL());
   }
 
@@ -951,7 +972,6 @@ class JNI {
     ScopedObjectAccess soa(env);
     JValue result(InvokeVirtualOrInterfaceWithVarArgs(soa, obj, mid, args));
     jobject ret=soa.AddLocalReference<jobject>(result.GetL());
-    ShowVarArgs(soa,__FUNCTION__,mid,args,ret);
     return ret;
   }
 
@@ -961,7 +981,6 @@ class JNI {
     ScopedObjectAccess soa(env);
     JValue result(InvokeVirtualOrInterfaceWithJValues(soa, obj, mid, args));
     jobject ret=soa.AddLocalReference<jobject>(result.GetL());
-//    ShowVarArgs(soa,__FUNCTION__,mid,args,ret);
     return ret;
   }
 
@@ -1922,7 +1941,8 @@ class JNI {
     // We do not perform full validation, only as much as necessary to avoid reading
     // beyond the terminating null character or breaking string compression invariants.
     // CheckJNI performs stronger validation.
-    size_t utf8_length = strlen(utf);
+    bool is_ascii;
+    size_t utf8_length = ScanModifiedUtf8Length(utf, &is_ascii);
     if (UNLIKELY(utf8_length > static_cast<uint32_t>(std::numeric_limits<int32_t>::max()))) {
       // Converting the utf8_length to int32_t for String::AllocFromModifiedUtf8() would
       // overflow. Throw OOME eagerly to avoid 2GiB allocation when trying to replace
@@ -1935,13 +1955,15 @@ class JNI {
     }
 
     std::optional<std::string> replacement_utf;
-    size_t utf16_length = VisitModifiedUtf8Chars(
-        utf,
-        utf8_length,
-        /*good=*/ [](const char* ptr ATTRIBUTE_UNUSED, size_t length ATTRIBUTE_UNUSED) {},
-        /*bad=*/ []() { return true; });  // Abort processing and return 0 for bad characters.
+    // ASCII input is valid and one char per byte, which also lets AllocFromModifiedUtf8() copy
+    // it into a compressed string without decoding. Otherwise this counts like
+    // VisitModifiedUtf8Chars() aborting at the first bad character, only decoding the blocks
+    // with non-ASCII bytes.
+    size_t utf16_length = is_ascii
+        ? utf8_length
+        : CountModifiedUtf8CharsFast(utf, utf8_length, mirror::kUseStringCompression);
     if (UNLIKELY(utf8_length != 0u && utf16_length == 0u)) {
-      // VisitModifiedUtf8Chars() aborted for a bad character.
+      // CountModifiedUtf8CharsFast() aborted for a bad character.
       android_errorWriteLog(0x534e4554, "172655291");  // Report to SafetyNet.
       // Report the error to logcat but avoid too much spam.
       static const uint64_t kMinDelay = UINT64_C(10000000000);  // 10s
@@ -1972,7 +1994,6 @@ class JNI {
     DCHECK_LE(utf8_length, static_cast<uint32_t>(std::numeric_limits<int32_t>::max()));
 
     ScopedObjectAccess soa(env);
-    ShowVarArgs(soa,__FUNCTION__,utf);
     ObjPtr<mirror::String> result =
         mirror::String::AllocFromModifiedUtf8(soa.Self(), utf16_length, utf, utf8_length);
     return soa.AddLocalReference<jstring>(result);
@@ -2025,15 +2046,13 @@ class JNI {
         return;
       }
       if (s->IsCompressed()) {
-        const uint8_t* src = s->GetValueCompressed() + start;
-        for (int i = 0; i < length; ++i) {
-          buf[i] = static_cast<jchar>(src[i]);
-        }
+        // Compressed strings only hold chars 1 to 0x7f, which are their own modified UTF-8.
+        memcpy(buf, s->GetValueCompressed() + start, length);
         buf[length] = '\0';
       } else {
         const jchar* chars = s->GetValue();
-        size_t bytes = CountUtf8Bytes(chars + start, length);
-        ConvertUtf16ToModifiedUtf8(buf, bytes, chars + start, length);
+        size_t bytes = CountUtf8BytesFast(chars + start, length);
+        ConvertUtf16ToModifiedUtf8Fast(buf, bytes, chars + start, length);
         buf[bytes] = '\0';
       }
     }
@@ -2140,20 +2159,19 @@ class JNI {
 
     ScopedObjectAccess soa(env);
     ObjPtr<mirror::String> s = soa.Decode<mirror::String>(java_string);
-    size_t byte_count = s->GetUtfLength();
+    // Same as s->GetUtfLength(), with the vectorized count.
+    const bool compressed = s->IsCompressed();
+    size_t byte_count =
+        compressed ? s->GetLength() : CountUtf8BytesFast(s->GetValue(), s->GetLength());
     char* bytes = new char[byte_count + 1];
     CHECK(bytes != nullptr);  // bionic aborts anyway.
-    if (s->IsCompressed()) {
-      const uint8_t* src = s->GetValueCompressed();
-      for (size_t i = 0; i < byte_count; ++i) {
-        bytes[i] = src[i];
-      }
+    if (compressed) {
+      memcpy(bytes, s->GetValueCompressed(), byte_count);
     } else {
       const uint16_t* chars = s->GetValue();
-      ConvertUtf16ToModifiedUtf8(bytes, byte_count, chars, s->GetLength());
+      ConvertUtf16ToModifiedUtf8Fast(bytes, byte_count, chars, s->GetLength());
     }
     bytes[byte_count] = '\0';
-    ShowVarArgs(soa,__FUNCTION__,is_copy,bytes);
     return bytes;
   }
 
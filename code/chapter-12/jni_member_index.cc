@@ -0,0 +1,310 @@
+#include "jni_member_index.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#include "art_field-inl.h"
+#include "art_method-inl.h"
+#include "base/globals.h"
+#include "linear_alloc.h"
+#include "mirror/class-inl.h"
+#include "mirror/class_loader.h"
+#include "runtime.h"
+
+namespace art {
+
+// Hashed index of JNI member lookups.
+//
+// GetMethodID and friends search the class, its superclasses and its interfaces comparing names
+// and signatures, and obfuscated native code repeats them in loops instead of keeping the ids.
+// The index remembers each search result in an open-addressed table, so a repeated lookup costs
+// one hash of the strings and a compare against the member found last time.
+//
+// Classes move, so entries are keyed by the methods array of the class instead, native memory
+// that stays put for the life of the class and is freed with its class loader; RemoveIn drops
+// the entries before that address can be reused. Classes without methods are not indexed.
+//
+// Every slot is a seqlock. Readers take no lock; a slot that is being written, or that changed
+// while it was read, is a miss. Writers are serialized by one lock. A hit is confirmed against
+// the name and signature of the member, so hash collisions only cost a miss. Class redefinition
+// needs no flush either: members it replaces fail the confirmation, and the next insert of the
+// same search overwrites their slot.
+//
+// JniClassIndex does the same for FindClass in a second table. Its entries are keyed by the
+// LinearAlloc of the class loader, native and freed with the loader like the methods arrays, and
+// store a declared method of the class in place of the class: the GC updates the declaring class
+// of methods but knows nothing of this table, and the method does not keep the class alive.
+// Arrays, primitives and classes that declare no methods are left to FindClass. A class replaced
+// by structural redefinition is obsolete and fails the confirmation like a collision.
+
+namespace {
+
+static constexpr size_t kSlots = 8 * KB;  // Power of two.
+static constexpr size_t kMaxProbes = 8;
+
+enum Kind : uint64_t {
+  kMethod,
+  kInstanceField,
+  kStaticField,
+  kClass,
+};
+
+struct Slot {
+  std::atomic<uint32_t> sequence{0u};  // Odd while the slot is written.
+  std::atomic<uintptr_t> klass{0u};    // Methods array of the class, 0 for a free slot.
+  std::atomic<uint64_t> hash{0u};
+  std::atomic<uintptr_t> member{0u};
+};
+
+struct Table {
+  Slot slots[kSlots];
+  std::mutex write_lock;
+};
+
+Table gMembers;
+Table gClasses;
+std::atomic<uint64_t> gClassHits{0u};
+std::atomic<uint64_t> gClassMisses{0u};
+
+uint64_t Hash(Kind kind, const char* name, const char* sig) {
+  // FNV-1a; the NUL between the strings keeps ("ab", "c") apart from ("a", "bc").
+  static constexpr uint64_t kPrime = UINT64_C(0x100000001b3);
+  uint64_t hash = (UINT64_C(0xcbf29ce484222325) ^ kind) * kPrime;
+  for (const char* p = name; *p != '\0'; ++p) {
+    hash = (hash ^ static_cast<uint8_t>(*p)) * kPrime;
+  }
+  hash *= kPrime;
+  for (const char* p = sig; *p != '\0'; ++p) {
+    hash = (hash ^ static_cast<uint8_t>(*p)) * kPrime;
+  }
+  return hash;
+}
+
+size_t Home(uintptr_t klass, uint64_t hash) {
+  return ((hash ^ (klass >> 3) * UINT64_C(0x9e3779b97f4a7c15)) >> 20) & (kSlots - 1u);
+}
+
+uintptr_t ClassKey(ObjPtr<mirror::Class> klass) REQUIRES_SHARED(Locks::mutator_lock_) {
+  // Proxy methods borrow their names from the interface methods; not worth indexing.
+  if (klass->IsProxyClass()) {
+    return 0u;
+  }
+  return reinterpret_cast<uintptr_t>(klass->GetMethodsPtr());
+}
+
+uintptr_t LoaderKey(ObjPtr<mirror::ClassLoader> class_loader)
+    REQUIRES_SHARED(Locks::mutator_lock_) {
+  // Null until the loader defines its first class.
+  LinearAlloc* allocator = class_loader == nullptr
+      ? Runtime::Current()->GetLinearAlloc()
+      : class_loader->GetAllocator();
+  return reinterpret_cast<uintptr_t>(allocator);
+}
+
+// Whether `method` was replaced by a class redefinition since it was indexed. Structural
+// redefinition leaves the old members with the old class, which is then obsolete.
+bool IsRedefined(ArtMethod* method) REQUIRES_SHARED(Locks::mutator_lock_) {
+  return method->IsObsolete() || method->GetDeclaringClass()->IsObsoleteObject();
+}
+
+// Whether `descriptor` is `name` as passed to JNI FindClass, without the '.' that FindClass also
+// accepts.
+bool DescriptorIsName(const char* descriptor, const char* name) {
+  const size_t length = strlen(name);
+  return descriptor[0] == 'L' &&
+         strncmp(descriptor + 1, name, length) == 0 &&
+         descriptor[length + 1] == ';' &&
+         descriptor[length + 2] == '\0';
+}
+
+template <typename Matches>
+uintptr_t Find(Table& table, uintptr_t klass, uint64_t hash, Matches matches) {
+  size_t index = Home(klass, hash);
+  for (size_t probe = 0; probe < kMaxProbes; ++probe, index = (index + 1u) & (kSlots - 1u)) {
+    Slot& slot = table.slots[index];
+    const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if ((sequence & 1u) != 0u) {
+      continue;
+    }
+    const uintptr_t slot_klass = slot.klass.load(std::memory_order_relaxed);
+    const uint64_t slot_hash = slot.hash.load(std::memory_order_relaxed);
+    const uintptr_t member = slot.member.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+      continue;
+    }
+    if (slot_klass == 0u) {
+      return 0u;
+    }
+    if (slot_klass == klass && slot_hash == hash && matches(member)) {
+      return member;
+    }
+  }
+  return 0u;
+}
+
+// Callers hold the write lock of the table.
+void Write(Slot* slot, uintptr_t klass, uint64_t hash, uintptr_t member) {
+  const uint32_t sequence = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(sequence + 1u, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->klass.store(klass, std::memory_order_relaxed);
+  slot->hash.store(hash, std::memory_order_relaxed);
+  slot->member.store(member, std::memory_order_relaxed);
+  slot->sequence.store(sequence + 2u, std::memory_order_release);
+}
+
+void Add(Table& table, uintptr_t klass, uint64_t hash, uintptr_t member) {
+  std::lock_guard<std::mutex> lock(table.write_lock);
+  size_t index = Home(klass, hash);
+  // With every probed slot taken, the home slot is overwritten.
+  Slot* target = &table.slots[index];
+  for (size_t probe = 0; probe < kMaxProbes; ++probe, index = (index + 1u) & (kSlots - 1u)) {
+    Slot& slot = table.slots[index];
+    const uintptr_t slot_klass = slot.klass.load(std::memory_order_relaxed);
+    if (slot_klass == 0u ||
+        (slot_klass == klass && slot.hash.load(std::memory_order_relaxed) == hash)) {
+      target = &slot;
+      break;
+    }
+  }
+  Write(target, klass, hash, member);
+}
+
+template <typename Predicate>
+void RemoveIf(Table& table, Predicate predicate) {
+  std::lock_guard<std::mutex> lock(table.write_lock);
+  for (Slot& slot : table.slots) {
+    const uintptr_t klass = slot.klass.load(std::memory_order_relaxed);
+    if (klass != 0u && predicate(klass, slot.member.load(std::memory_order_relaxed))) {
+      Write(&slot, 0u, 0u, 0u);
+    }
+  }
+}
+
+}  // namespace
+
+ArtMethod* JniMemberIndex::LookupMethod(ObjPtr<mirror::Class> klass,
+                                        const char* name,
+                                        const char* sig) {
+  const uintptr_t key = ClassKey(klass);
+  if (key == 0u) {
+    return nullptr;
+  }
+  const uintptr_t member = Find(gMembers, key, Hash(kMethod, name, sig), [&](uintptr_t candidate)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    ArtMethod* method = reinterpret_cast<ArtMethod*>(candidate);
+    return !IsRedefined(method) && method->GetNameView() == name && method->GetSignature() == sig;
+  });
+  return reinterpret_cast<ArtMethod*>(member);
+}
+
+void JniMemberIndex::InsertMethod(ObjPtr<mirror::Class> klass,
+                                  const char* name,
+                                  const char* sig,
+                                  ArtMethod* method) {
+  const uintptr_t key = ClassKey(klass);
+  if (key != 0u) {
+    Add(gMembers, key, Hash(kMethod, name, sig), reinterpret_cast<uintptr_t>(method));
+  }
+}
+
+ArtField* JniMemberIndex::LookupField(ObjPtr<mirror::Class> klass,
+                                      bool is_static,
+                                      const char* name,
+                                      const char* sig) {
+  const uintptr_t key = ClassKey(klass);
+  if (key == 0u) {
+    return nullptr;
+  }
+  const uint64_t hash = Hash(is_static ? kStaticField : kInstanceField, name, sig);
+  const uintptr_t member = Find(gMembers, key, hash, [&](uintptr_t candidate)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    ArtField* field = reinterpret_cast<ArtField*>(candidate);
+    return !field->GetDeclaringClass()->IsObsoleteObject() &&
+           strcmp(field->GetName(), name) == 0 &&
+           strcmp(field->GetTypeDescriptor(), sig) == 0;
+  });
+  return reinterpret_cast<ArtField*>(member);
+}
+
+void JniMemberIndex::InsertField(ObjPtr<mirror::Class> klass,
+                                 bool is_static,
+                                 const char* name,
+                                 const char* sig,
+                                 ArtField* field) {
+  const uintptr_t key = ClassKey(klass);
+  if (key != 0u) {
+    Add(gMembers,
+           key,
+           Hash(is_static ? kStaticField : kInstanceField, name, sig),
+           reinterpret_cast<uintptr_t>(field));
+  }
+}
+
+void JniMemberIndex::RemoveIn(const LinearAlloc& allocator) {
+  // The member may be declared by a superclass of another loader, and the other way round.
+  RemoveIf(gMembers, [&](uintptr_t klass, uintptr_t member) {
+    return allocator.ContainsUnsafe(reinterpret_cast<void*>(klass)) ||
+           allocator.ContainsUnsafe(reinterpret_cast<void*>(member));
+  });
+}
+
+ObjPtr<mirror::Class> JniClassIndex::Lookup(ObjPtr<mirror::ClassLoader> class_loader,
+                                            const char* name) {
+  const uintptr_t key = LoaderKey(class_loader);
+  if (key == 0u || name[0] == '[') {
+    gClassMisses.fetch_add(1u, std::memory_order_relaxed);
+    return nullptr;
+  }
+  ObjPtr<mirror::Class> klass = nullptr;
+  Find(gClasses, key, Hash(kClass, name, ""), [&](uintptr_t candidate)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    ObjPtr<mirror::Class> declaring_class =
+        reinterpret_cast<ArtMethod*>(candidate)->GetDeclaringClass();
+    // Structural redefinition leaves the methods with the old class.
+    if (declaring_class->IsObsoleteObject()) {
+      return false;
+    }
+    std::string temp;
+    if (!DescriptorIsName(declaring_class->GetDescriptor(&temp), name)) {
+      return false;
+    }
+    klass = declaring_class;
+    return true;
+  });
+  (klass != nullptr ? gClassHits : gClassMisses).fetch_add(1u, std::memory_order_relaxed);
+  return klass;
+}
+
+void JniClassIndex::Insert(ObjPtr<mirror::ClassLoader> class_loader,
+                           const char* name,
+                           ObjPtr<mirror::Class> klass) {
+  const uintptr_t key = LoaderKey(class_loader);
+  if (key == 0u || name[0] == '[' || strchr(name, '.') != nullptr || klass->IsProxyClass()) {
+    return;
+  }
+  auto methods = klass->GetDeclaredMethods(kRuntimePointerSize);
+  if (methods.size() != 0u) {
+    Add(gClasses, key, Hash(kClass, name, ""), reinterpret_cast<uintptr_t>(&methods[0]));
+  }
+}
+
+void JniClassIndex::RemoveIn(const LinearAlloc& allocator) {
+  RemoveIf(gClasses, [&](uintptr_t loader, uintptr_t method) {
+    return loader == reinterpret_cast<uintptr_t>(&allocator) ||
+           allocator.ContainsUnsafe(reinterpret_cast<void*>(method));
+  });
+}
+
+void JniClassIndex::Dump(std::ostream& os) {
+  os << "JNI FindClass index: hits=" << gClassHits.load(std::memory_order_relaxed)
+     << " misses=" << gClassMisses.load(std::memory_order_relaxed) << "\n";
+}
+
+}  // namespace art
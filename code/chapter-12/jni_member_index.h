@@ -0,0 +1,74 @@
+#ifndef ART_RUNTIME_JNI_MEMBER_INDEX_H_
+#define ART_RUNTIME_JNI_MEMBER_INDEX_H_
+
+#include <iosfwd>
+
+#include "base/locks.h"
+#include "obj_ptr.h"
+
+namespace art {
+
+class ArtField;
+class ArtMethod;
+class LinearAlloc;
+
+namespace mirror {
+class Class;
+class ClassLoader;
+}  // namespace mirror
+
+// Results of the class hierarchy searches behind GetMethodID, GetStaticMethodID, GetFieldID and
+// GetStaticFieldID, keyed by class and a hash of name and signature; see jni_member_index.cc.
+// Only the search is cached, callers still apply the access checks of the calling context and
+// the static/non-static check to what it returns. Failed searches are not cached.
+class JniMemberIndex {
+ public:
+  // The method FindClassMethod or, for interfaces, FindInterfaceMethod returned for `klass`,
+  // or null if it was not recorded.
+  static ArtMethod* LookupMethod(ObjPtr<mirror::Class> klass, const char* name, const char* sig)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+  static void InsertMethod(ObjPtr<mirror::Class> klass,
+                           const char* name,
+                           const char* sig,
+                           ArtMethod* method)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // The field FindStaticField or FindInstanceField returned for `klass`, or null.
+  static ArtField* LookupField(ObjPtr<mirror::Class> klass,
+                               bool is_static,
+                               const char* name,
+                               const char* sig)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+  static void InsertField(ObjPtr<mirror::Class> klass,
+                          bool is_static,
+                          const char* name,
+                          const char* sig,
+                          ArtField* field)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Forgets the entries of classes and members allocated in `allocator`, whose class loader is
+  // being unloaded.
+  static void RemoveIn(const LinearAlloc& allocator);
+};
+
+// Results of JNI FindClass, keyed by the class loader of the caller and a hash of the name as it
+// was passed, before it is turned into a descriptor. Counts hits and misses for SIGQUIT dumps.
+class JniClassIndex {
+ public:
+  // The class FindClass returned for `name` and `class_loader`, or null.
+  static ObjPtr<mirror::Class> Lookup(ObjPtr<mirror::ClassLoader> class_loader, const char* name)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+  static void Insert(ObjPtr<mirror::ClassLoader> class_loader,
+                     const char* name,
+                     ObjPtr<mirror::Class> klass)
+      REQUIRES_SHARED(Locks::mutator_lock_);
+
+  // Forgets the entries of the class loader that owns `allocator`, and of its classes.
+  static void RemoveIn(const LinearAlloc& allocator);
+
+  static void Dump(std::ostream& os);
+};
+
+}  // namespace art
+
+#endif  // ART_RUNTIME_JNI_MEMBER_INDEX_H_
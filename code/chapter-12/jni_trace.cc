@@ -0,0 +1,1232 @@
+#include "jni_trace.h"
+
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unwind.h>
+
+#include <algorithm>
+#include <string>
+
+#include "art_method-inl.h"
+#include "base/bit_utils.h"
+#include "base/mutex.h"
+#include "base/time_utils.h"
+#include "base/utils.h"
+#include "class_linker.h"
+#include "runtime.h"
+#include "thread.h"
+
+namespace art {
+
+// Ring size of every traced thread. Records are at most 4 KiB so this holds a few thousand
+// events between two flushes.
+static constexpr size_t kJniTraceBufferCapacity = 256 * KB;
+// The owning thread flushes its ring once it is this full instead of dropping events.
+static constexpr size_t kJniTraceFlushThreshold = kJniTraceBufferCapacity * 3 / 4;
+
+// The overhead governor compares tracing time with thread CPU time over periods of this length,
+// extended until the thread ran long enough for the share to mean something.
+static constexpr uint64_t kGovernorPeriodNs = MsToNs(100);
+static constexpr uint64_t kGovernorMinCpuNs = MsToNs(5);
+
+// Interned JNIEnv function names. Callers pass __FUNCTION__, so the pointer identifies the
+// name and the slot index is used as its id in the records.
+static constexpr size_t kMaxFunctionNames = 1024;
+static std::atomic<const char*> gFunctionNames[kMaxFunctionNames];
+
+// End of the running capture window, see JniTrace::CheckTrigger. Only ever moves forward.
+static std::atomic<uint64_t> gCaptureUntilNs{0u};
+
+// See JniTrace::UnloadEpoch.
+static std::atomic<uint32_t> gUnloadEpoch{0u};
+
+__thread uint32_t gJniTraceDepth = 0u;
+__thread ArtMethod** gJniTraceNativeFrames[kJniTraceMaxNativeDepth];
+__thread uint64_t gJniTraceNativeStartNs[kJniTraceMaxNativeDepth];
+
+// Open-addressed table of ArtMethod* verdicts. A slot holds the method pointer with the verdict
+// in bit 0; ArtMethods are at least 4-byte aligned so the low bits are free.
+static constexpr size_t kMethodFilterCapacity = 16 * KB;
+static constexpr size_t kMethodFilterMaxProbes = 32;
+static constexpr uintptr_t kMethodFilterWatchedBit = 1u;
+static std::atomic<uintptr_t> gMethodFilter[kMethodFilterCapacity];
+
+// Interned stacks, indexed by stack id.
+struct JniTraceStack {
+  uint64_t hash;
+  size_t count;
+  std::atomic<bool> logged;
+  std::atomic<bool> flight_recorded;
+  uintptr_t pcs[kJniTraceMaxFrames];
+};
+static constexpr size_t kStackTableCapacity = 16 * KB;
+static constexpr size_t kStackTableMaxProbes = 64;
+static std::atomic<JniTraceStack*> gStackTable[kStackTableCapacity];
+
+JniTraceBuffer::JniTraceBuffer(size_t capacity, uint8_t* data, JniTraceRingPositions* positions)
+    : overwrite_(data != nullptr),
+      data_(data != nullptr ? data : new uint8_t[capacity]),
+      capacity_(capacity),
+      positions_(positions != nullptr ? positions : &own_positions_),
+      dropped_(0) {
+  DCHECK(IsPowerOfTwo(capacity));
+  DCHECK_EQ(data != nullptr, positions != nullptr);
+}
+
+JniTraceBuffer::~JniTraceBuffer() {
+  if (!overwrite_) {
+    delete[] data_;
+  }
+}
+
+JniTraceRecord* JniTraceBuffer::Reserve(size_t max_payload) {
+  const size_t size = RoundUp(sizeof(JniTraceRecord) + max_payload, kJniTraceRecordAlignment);
+  uint64_t head = positions_->head.load(std::memory_order_relaxed);
+  const uint64_t tail = positions_->tail.load(std::memory_order_acquire);
+  const size_t offset = head & (capacity_ - 1);
+  // Records never wrap; pad up to the end of the ring if the record would not fit there.
+  const size_t padding = (offset + size > capacity_) ? capacity_ - offset : 0u;
+  if (UNLIKELY(head + padding + size - tail > capacity_)) {
+    if (!overwrite_) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    Evict(tail, head + padding + size - capacity_);
+  }
+  if (padding != 0u) {
+    JniTraceRecord* pad = reinterpret_cast<JniTraceRecord*>(data_ + offset);
+    pad->event = static_cast<uint16_t>(JniTraceEvent::kPadding);
+    pad->size = static_cast<uint16_t>(padding);
+    head += padding;
+    positions_->head.store(head, std::memory_order_release);
+  }
+  return reinterpret_cast<JniTraceRecord*>(data_ + (head & (capacity_ - 1)));
+}
+
+void JniTraceBuffer::Commit(JniTraceRecord* record) {
+  const size_t size = RoundUp(sizeof(JniTraceRecord) + record->payload_size,
+                              kJniTraceRecordAlignment);
+  record->size = static_cast<uint16_t>(size);
+  positions_->head.store(positions_->head.load(std::memory_order_relaxed) + size,
+                         std::memory_order_release);
+}
+
+void JniTraceBuffer::Evict(uint64_t tail, uint64_t min_tail) {
+  // Only the producer moves the tail of an evicting ring, and everything before the head is a
+  // complete record. The tail moves before the space is reused, so a reader of the file never
+  // sees a record being overwritten.
+  while (tail < min_tail) {
+    tail += reinterpret_cast<const JniTraceRecord*>(data_ + (tail & (capacity_ - 1)))->size;
+  }
+  positions_->tail.store(tail, std::memory_order_release);
+}
+
+void JniTraceBuffer::Trim(size_t max_used) {
+  DCHECK(!overwrite_);
+  const uint64_t head = positions_->head.load(std::memory_order_relaxed);
+  const uint64_t tail = positions_->tail.load(std::memory_order_relaxed);
+  if (head - tail > max_used) {
+    Evict(tail, head - max_used);
+  }
+}
+
+void JniTracePayloadWriter::PutRawString(const char* data, size_t length) {
+  if (UNLIKELY(overflowed_ || pos_ + sizeof(uint16_t) > end_)) {
+    overflowed_ = true;
+    return;
+  }
+  length = std::min(length, static_cast<size_t>(end_ - pos_) - sizeof(uint16_t));
+  PutRaw(static_cast<uint16_t>(length));
+  memcpy(pos_, data, length);
+  pos_ += length;
+}
+
+void JniTracePayloadWriter::PutRawUtf16String(const uint16_t* data, size_t length) {
+  if (UNLIKELY(overflowed_ || pos_ + sizeof(uint16_t) > end_)) {
+    overflowed_ = true;
+    return;
+  }
+  uint8_t* const length_pos = pos_;
+  uint8_t* out = pos_ + sizeof(uint16_t);
+  uint8_t* const limit = std::min(end_, out + kJniTraceMaxString);
+  for (size_t i = 0; i < length; ++i) {
+    const uint16_t ch = data[i];
+    if (ch != 0 && ch < 0x80) {
+      if (out + 1 > limit) break;
+      *out++ = static_cast<uint8_t>(ch);
+    } else if (ch < 0x800) {
+      if (out + 2 > limit) break;
+      *out++ = static_cast<uint8_t>(0xc0 | (ch >> 6));
+      *out++ = static_cast<uint8_t>(0x80 | (ch & 0x3f));
+    } else {
+      if (out + 3 > limit) break;
+      *out++ = static_cast<uint8_t>(0xe0 | (ch >> 12));
+      *out++ = static_cast<uint8_t>(0x80 | ((ch >> 6) & 0x3f));
+      *out++ = static_cast<uint8_t>(0x80 | (ch & 0x3f));
+    }
+  }
+  const uint16_t length16 = static_cast<uint16_t>(out - (length_pos + sizeof(uint16_t)));
+  memcpy(length_pos, &length16, sizeof(length16));
+  pos_ = out;
+}
+
+void JniTracePayloadWriter::PutFrames(const uintptr_t* pcs, size_t count) {
+  if (UNLIKELY(overflowed_ || pos_ + 1 + sizeof(uint16_t) > end_)) {
+    overflowed_ = true;
+    return;
+  }
+  count = std::min(count, (static_cast<size_t>(end_ - pos_) - 1 - sizeof(uint16_t)) /
+                              sizeof(uint64_t));
+  BeginField(JniTraceField::kBacktrace);
+  PutRaw(static_cast<uint16_t>(count));
+  for (size_t i = 0; i < count; ++i) {
+    PutRaw(static_cast<uint64_t>(pcs[i]));
+  }
+  EndField();
+}
+
+bool JniTraceMethodFilter::IsWatched(ArtMethod* method) {
+  return Lookup(method, /*recompute=*/ false);
+}
+
+void JniTraceMethodFilter::Prime(ArtMethod* method) {
+  Lookup(method, /*recompute=*/ true);
+}
+
+bool JniTraceMethodFilter::Lookup(ArtMethod* method, bool recompute) {
+  const uintptr_t key = reinterpret_cast<uintptr_t>(method);
+  DCHECK_EQ(key & kMethodFilterWatchedBit, 0u);
+  size_t index = ((key >> 2) * 0x9e3779b9u) & (kMethodFilterCapacity - 1);
+  for (size_t probe = 0; probe < kMethodFilterMaxProbes; ++probe) {
+    std::atomic<uintptr_t>& slot = gMethodFilter[index];
+    uintptr_t current = slot.load(std::memory_order_acquire);
+    const bool cached = (current & ~kMethodFilterWatchedBit) == key;
+    if (cached && !recompute) {
+      return (current & kMethodFilterWatchedBit) != 0u;
+    }
+    if (cached || current == 0u) {
+      // Pinned until the verdict is stored, JniTraceConfig::Publish clears the table only once
+      // no verdict of the previous config can still be inserted.
+      JniTraceConfigScope config;
+      const Verdict verdict = Matches(*config.Get(), method);
+      if (verdict == Verdict::kUnresolved && !cached) {
+        return false;
+      }
+      // A rebound method still bound to the lookup stub is not watched until it resolves, which
+      // goes through RegisterNative and primes it again.
+      const bool watched = verdict == Verdict::kWatched;
+      const uintptr_t value = key | (watched ? kMethodFilterWatchedBit : 0u);
+      // Losing the race to another method just means this verdict is not cached. Losing it to
+      // a lookup of this method that started before the rebind must not keep its stale verdict.
+      while (!slot.compare_exchange_weak(current, value, std::memory_order_acq_rel) &&
+             (current == 0u || (recompute && (current & ~kMethodFilterWatchedBit) == key))) {
+      }
+      return watched;
+    }
+    index = (index + 1) & (kMethodFilterCapacity - 1);
+  }
+  // Table saturated, compute without caching.
+  JniTraceConfigScope config;
+  return Matches(*config.Get(), method) == Verdict::kWatched;
+}
+
+void JniTraceMethodFilter::Clear() {
+  for (std::atomic<uintptr_t>& slot : gMethodFilter) {
+    slot.store(0u, std::memory_order_relaxed);
+  }
+}
+
+// PrettyMethod() without the leading return type, so that anchored globs such as
+// "com.example.*" see the class name first: "com.example.Foo.bar(int, java.lang.String)".
+static std::string MethodFilterText(ArtMethod* method) NO_THREAD_SAFETY_ANALYSIS {
+  std::string pretty = method->PrettyMethod();
+  const size_t space = pretty.find(' ');
+  if (space != std::string::npos) {
+    pretty.erase(0, space + 1);
+  }
+  return pretty;
+}
+
+// The jni end hooks run this before going back to runnable, as the original strstr check did.
+JniTraceMethodFilter::Verdict JniTraceMethodFilter::Matches(const JniTraceConfig& config,
+                                                           ArtMethod* method)
+    NO_THREAD_SAFETY_ANALYSIS {
+  if (!config.method_filter.Matches(MethodFilterText(method))) {
+    return Verdict::kNotWatched;
+  }
+  if (config.module_filter.IsEmpty()) {
+    return Verdict::kWatched;
+  }
+  const void* code = method->GetEntryPointFromJni();
+  ClassLinker* class_linker = Runtime::Current()->GetClassLinker();
+  if (class_linker->IsJniDlsymLookupStub(code) ||
+      class_linker->IsJniDlsymLookupCriticalStub(code)) {
+    return Verdict::kUnresolved;
+  }
+  const JniTraceModule* module = JniTraceModuleIndex::Find(reinterpret_cast<uintptr_t>(code));
+  return module != nullptr && config.module_filter.Matches(module->name)
+      ? Verdict::kWatched
+      : Verdict::kNotWatched;
+}
+
+static uint64_t HashStack(const uintptr_t* pcs, size_t count) {
+  uint64_t hash = UINT64_C(0xcbf29ce484222325) ^ count;
+  for (size_t i = 0; i < count; ++i) {
+    hash = (hash ^ pcs[i]) * UINT64_C(0x100000001b3);
+  }
+  // The low bits pick the slot, fold the high bits in.
+  return hash ^ (hash >> 29);
+}
+
+static bool SameStack(const JniTraceStack* stack,
+                      uint64_t hash,
+                      const uintptr_t* pcs,
+                      size_t count) {
+  return stack->hash == hash &&
+         stack->count == count &&
+         memcmp(stack->pcs, pcs, count * sizeof(uintptr_t)) == 0;
+}
+
+uint32_t JniTraceStackTable::Intern(const uintptr_t* pcs, size_t count) {
+  DCHECK_LE(count, kJniTraceMaxFrames);
+  const uint64_t hash = HashStack(pcs, count);
+  JniTraceStack* created = nullptr;
+  size_t index = hash & (kStackTableCapacity - 1);
+  for (size_t probe = 0; probe < kStackTableMaxProbes; ++probe) {
+    std::atomic<JniTraceStack*>& slot = gStackTable[index];
+    JniTraceStack* current = slot.load(std::memory_order_acquire);
+    if (current == nullptr) {
+      // Only new stacks allocate, which stops happening once the call sites have been seen.
+      if (created == nullptr) {
+        created = new JniTraceStack();
+        created->hash = hash;
+        created->count = count;
+        created->logged.store(false, std::memory_order_relaxed);
+        created->flight_recorded.store(false, std::memory_order_relaxed);
+        memcpy(created->pcs, pcs, count * sizeof(uintptr_t));
+      }
+      if (slot.compare_exchange_strong(current, created, std::memory_order_acq_rel)) {
+        return static_cast<uint32_t>(index);
+      }
+      // Another thread filled the slot, maybe with this very stack.
+    }
+    if (SameStack(current, hash, pcs, count)) {
+      delete created;
+      return static_cast<uint32_t>(index);
+    }
+    index = (index + 1) & (kStackTableCapacity - 1);
+  }
+  delete created;
+  return kInvalidId;
+}
+
+const uintptr_t* JniTraceStackTable::GetFrames(uint32_t id, size_t* count) {
+  JniTraceStack* stack =
+      gStackTable[id & (kStackTableCapacity - 1)].load(std::memory_order_acquire);
+  if (stack == nullptr) {
+    *count = 0;
+    return nullptr;
+  }
+  *count = stack->count;
+  return stack->pcs;
+}
+
+bool JniTraceStackTable::MarkLogged(uint32_t id) {
+  JniTraceStack* stack =
+      gStackTable[id & (kStackTableCapacity - 1)].load(std::memory_order_acquire);
+  return stack != nullptr && !stack->logged.exchange(true, std::memory_order_relaxed);
+}
+
+bool JniTraceStackTable::MarkFlightRecorded(uint32_t id) {
+  JniTraceStack* stack =
+      gStackTable[id & (kStackTableCapacity - 1)].load(std::memory_order_acquire);
+  return stack != nullptr && !stack->flight_recorded.exchange(true, std::memory_order_relaxed);
+}
+
+JniTraceThreadState::JniTraceThreadState(pid_t thread_id)
+    : tid(thread_id),
+      flight_slot(JniTraceFlightRecorder::AcquireSlot(thread_id)),
+      buffer(flight_slot != nullptr ? kJniTraceFlightRingBytes : kJniTraceBufferCapacity,
+             flight_slot != nullptr ? flight_slot->Data() : nullptr,
+             flight_slot != nullptr ? &flight_slot->positions : nullptr),
+      stack_begin(0u),
+      stack_end(0u) {
+  pthread_attr_t attr;
+  if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+    void* stack_addr;
+    size_t stack_size;
+    if (pthread_attr_getstack(&attr, &stack_addr, &stack_size) == 0) {
+      stack_begin = reinterpret_cast<uintptr_t>(stack_addr);
+      stack_end = stack_begin + stack_size;
+    }
+    pthread_attr_destroy(&attr);
+  }
+}
+
+JniTraceThreadState::~JniTraceThreadState() {
+  if (flight_slot != nullptr) {
+    // The records stay in the file until the next owner of the slot overwrites them.
+    JniTraceFlightRecorder::ReleaseSlot(flight_slot);
+  }
+}
+
+namespace {
+
+// Owns the state of one thread and flushes it when the thread exits, unless the drain thread
+// takes it over.
+struct JniTraceThreadStateHolder {
+  ~JniTraceThreadStateHolder() {
+    if (state != nullptr && !JniTraceDrain::Retire(state)) {
+      JniTrace::FlushCurrentThread();
+      delete state;
+    }
+  }
+
+  JniTraceThreadState* state = nullptr;
+};
+
+thread_local JniTraceThreadStateHolder gThreadState;
+
+// Text of one record. Unbounded: sinks other than logcat have no line limit, and the logcat
+// sink splits what is too long for it.
+class LineBuilder {
+ public:
+  void Append(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    va_list ap;
+    va_start(ap, fmt);
+    AppendV(fmt, ap);
+    va_end(ap);
+  }
+
+  void AppendV(const char* fmt, va_list ap) {
+    char buf[256];
+    va_list copy;
+    va_copy(copy, ap);
+    const int n = vsnprintf(buf, sizeof(buf), fmt, copy);
+    va_end(copy);
+    if (n <= 0) {
+      return;
+    }
+    if (static_cast<size_t>(n) < sizeof(buf)) {
+      text_.append(buf, n);
+      return;
+    }
+    const size_t pos = text_.size();
+    text_.resize(pos + n + 1u);
+    vsnprintf(&text_[pos], n + 1u, fmt, ap);
+    text_.resize(pos + n);
+  }
+
+  const std::string& str() const {
+    return text_;
+  }
+
+ private:
+  std::string text_;
+};
+
+// Collects the text of a flush and hands it to the sink in large batches.
+class TraceOutput {
+ public:
+  explicit TraceOutput(JniTraceSink* sink) : sink_(sink) {}
+
+  ~TraceOutput() {
+    Flush();
+  }
+
+  void Add(const std::string& text) {
+    batch_.append(text);
+    if (!batch_.empty() && batch_.back() != '\n') {
+      batch_.push_back('\n');
+    }
+    if (batch_.size() >= kJniTraceSinkBatchBytes) {
+      Flush();
+    }
+  }
+
+  void Printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    LineBuilder line;
+    va_list ap;
+    va_start(ap, fmt);
+    line.AppendV(fmt, ap);
+    va_end(ap);
+    Add(line.str());
+  }
+
+  void Flush() {
+    if (!batch_.empty()) {
+      sink_->Write(batch_);
+      batch_.clear();
+    }
+  }
+
+ private:
+  JniTraceSink* const sink_;
+  std::string batch_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceOutput);
+};
+
+// `epoch` is JniTrace::UnloadEpoch() when the flush started. The method of a record made before
+// a class loader was unloaded, or of one flushed while that happens, may be freed or reused; it
+// is printed as the raw pointer.
+const char* PrettyTraceMethod(const JniTraceRecord& record,
+                              uint32_t epoch,
+                              std::string* storage) NO_THREAD_SAFETY_ANALYSIS {
+  ArtMethod* art_method = reinterpret_cast<ArtMethod*>(record.method);
+  if (art_method == nullptr) {
+    return "null";
+  }
+  // Records are flushed from runnable code in the common case, but a thread that exits from
+  // native code has no mutator lock to pretty print with.
+  Thread* self = Thread::Current();
+  if (self == nullptr || !Locks::mutator_lock_->IsSharedHeld(self)) {
+    return "?";
+  }
+  if (record.unload_epoch == epoch) {
+    // ClassLinker::CleanupClassLoaders moves the epoch under the writer lock before it frees
+    // anything, so the method stays allocated while the epoch is unchanged under the lock.
+    ReaderMutexLock mu(self, *Locks::classlinker_classes_lock_);
+    if (JniTrace::UnloadEpoch() == epoch) {
+      *storage = art_method->PrettyMethod();
+      return storage->c_str();
+    }
+  }
+  char unnamed[32];
+  snprintf(unnamed, sizeof(unnamed), "unloaded %p", art_method);
+  *storage = unnamed;
+  return storage->c_str();
+}
+
+// Symbolizes `pcs` in the debuggerd format. The leading frames inside libart are the recorder
+// itself and are left out. Modules come from the address index, dladdr is only asked for the
+// symbol name.
+void LogBacktrace(const char* title, const uintptr_t* pcs, size_t count, TraceOutput* out) {
+  static const JniTraceModule* const libart = JniTraceModuleIndex::Find(
+      reinterpret_cast<uintptr_t>(&JniTrace::FlushCurrentThread));
+  LineBuilder line;
+  line.Append("-----------------------%s-------------------------\n", title);
+  bool in_recorder = true;
+  size_t index = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const uintptr_t pc = pcs[i];
+    const JniTraceModule* module = JniTraceModuleIndex::Find(pc);
+    if (module == nullptr) {
+      in_recorder = false;
+      line.Append("#%02zu pc %016" PRIxPTR "  <unknown>\n", index++, pc);
+      continue;
+    }
+    if (in_recorder && module == libart) {
+      continue;
+    }
+    in_recorder = false;
+    line.Append("#%02zu pc %016" PRIxPTR "  %s",
+                index++, pc - module->load_bias, module->name.c_str());
+    Dl_info info;
+    if (dladdr(reinterpret_cast<const void*>(pc), &info) != 0 && info.dli_sname != nullptr) {
+      line.Append(" (%s+%" PRIuPTR ")",
+                  info.dli_sname, pc - reinterpret_cast<uintptr_t>(info.dli_saddr));
+    }
+    if (module->build_id_size != 0u) {
+      line.Append(" (BuildId: ");
+      for (size_t j = 0; j < module->build_id_size; ++j) {
+        line.Append("%02x", module->build_id[j]);
+      }
+      line.Append(")");
+    }
+    line.Append("\n");
+  }
+  out->Add(line.str());
+}
+
+void AppendField(LineBuilder* line,
+                 JniTracePayloadReader* reader,
+                 const char* prefix,
+                 TraceOutput* out) {
+  const JniTraceField tag = reader->NextTag();
+  uint16_t length;
+  switch (tag) {
+    case JniTraceField::kBoolean:
+      line->Append("jnitrace           %s     jboolean     : %s\n",
+                   prefix, reader->GetValue<uint8_t>() != 0u ? "true" : "false");
+      break;
+    case JniTraceField::kByte:
+      line->Append("jnitrace           %s     jbyte        : %d\n",
+                   prefix, reader->GetValue<int8_t>());
+      break;
+    case JniTraceField::kChar:
+      line->Append("jnitrace           %s     jchar        : 0x%04x\n",
+                   prefix, reader->GetValue<uint16_t>());
+      break;
+    case JniTraceField::kShort:
+      line->Append("jnitrace           %s     jshort       : %d\n",
+                   prefix, reader->GetValue<int16_t>());
+      break;
+    case JniTraceField::kInt:
+      line->Append("jnitrace           %s     jint         : %d\n",
+                   prefix, reader->GetValue<int32_t>());
+      break;
+    case JniTraceField::kLong:
+      line->Append("jnitrace           %s     jlong         : %" PRId64 "\n",
+                   prefix, reader->GetValue<int64_t>());
+      break;
+    case JniTraceField::kFloat:
+      line->Append("jnitrace           %s     jfloat       : %f\n",
+                   prefix, reader->GetValue<float>());
+      break;
+    case JniTraceField::kDouble:
+      line->Append("jnitrace           %s     jdouble       : %f\n",
+                   prefix, reader->GetValue<double>());
+      break;
+    case JniTraceField::kNull:
+      line->Append("jnitrace           %s     jobject      : null\n", prefix);
+      break;
+    case JniTraceField::kPointer:
+      line->Append("jnitrace           %s     jobject      : %p\n",
+                   prefix, reinterpret_cast<void*>(reader->GetValue<uint64_t>()));
+      break;
+    case JniTraceField::kString: {
+      const char* data = reader->GetString(&length);
+      line->Append("jnitrace           %s     jstring      : %.*s\n", prefix, length, data);
+      break;
+    }
+    case JniTraceField::kObject: {
+      const char* data = reader->GetString(&length);
+      const uint32_t hash = reader->GetValue<uint32_t>();
+      line->Append("jnitrace           %s     jobject      : {%.*s} @%08x\n",
+                   prefix, length, data, hash);
+      break;
+    }
+    case JniTraceField::kJavaString: {
+      const char* data = reader->GetString(&length);
+      const uint32_t hash = reader->GetValue<uint32_t>();
+      line->Append("jnitrace           %s     jstring      : %.*s @%08x\n",
+                   prefix, length, data, hash);
+      break;
+    }
+    case JniTraceField::kArray: {
+      const char* descriptor = reader->GetString(&length);
+      const int32_t count = reader->GetValue<int32_t>();
+      uint16_t prefix_length;
+      const uint8_t* bytes = reinterpret_cast<const uint8_t*>(reader->GetString(&prefix_length));
+      const uint32_t hash = reader->GetValue<uint32_t>();
+      line->Append("jnitrace           %s     jarray       : {%.*s} length=%d @%08x",
+                   prefix, length, descriptor, count, hash);
+      if (prefix_length != 0u) {
+        line->Append(" [");
+        for (uint16_t i = 0; i < prefix_length; ++i) {
+          line->Append(i == 0u ? "%02x" : " %02x", bytes[i]);
+        }
+        line->Append("]");
+      }
+      line->Append("\n");
+      break;
+    }
+    case JniTraceField::kBacktrace: {
+      uintptr_t pcs[kJniTraceMaxFrames];
+      const size_t count = std::min<size_t>(reader->GetValue<uint16_t>(), kJniTraceMaxFrames);
+      for (size_t i = 0; i < count; ++i) {
+        pcs[i] = static_cast<uintptr_t>(reader->GetValue<uint64_t>());
+      }
+      LogBacktrace("Backtrace", pcs, count, out);
+      break;
+    }
+    case JniTraceField::kStackId: {
+      const uint32_t id = reader->GetValue<uint32_t>();
+      if (JniTraceStackTable::MarkLogged(id)) {
+        size_t count;
+        const uintptr_t* pcs = JniTraceStackTable::GetFrames(id, &count);
+        char title[32];
+        snprintf(title, sizeof(title), "Backtrace #%u", id);
+        LogBacktrace(title, pcs, count, out);
+      }
+      line->Append("jnitrace           %s     backtrace    : #%u\n", prefix, id);
+      break;
+    }
+    case JniTraceField::kResult:
+      break;
+  }
+}
+
+const char* DetailName(JniTraceDetail detail) {
+  switch (detail) {
+    case JniTraceDetail::kFull:
+      return "full";
+    case JniTraceDetail::kNoBacktraces:
+      return "no backtraces";
+    case JniTraceDetail::kNoArguments:
+      return "no arguments";
+    case JniTraceDetail::kCountersOnly:
+      return "counters only";
+  }
+  return "?";
+}
+
+void LogRecord(const JniTraceRecord& record, uint32_t epoch, TraceOutput* out) {
+  LineBuilder line;
+  std::string method_storage;
+  JniTracePayloadReader reader(record);
+  uint16_t length;
+  const JniTraceEvent event = static_cast<JniTraceEvent>(record.event);
+  line.Append("jnitrace           /* TID %u */\n", record.tid);
+  if (event == JniTraceEvent::kDetailChange) {
+    reader.NextTag();
+    const int32_t detail = reader.GetValue<int32_t>();
+    reader.NextTag();
+    const int32_t per_mille = reader.GetValue<int32_t>();
+    line.Append("jnitrace           tracing took %d.%d%% of thread CPU, detail lowered to %s\n",
+                per_mille / 10, per_mille % 10, DetailName(static_cast<JniTraceDetail>(detail)));
+    out->Add(line.str());
+    return;
+  }
+  if (event == JniTraceEvent::kEnterNative || event == JniTraceEvent::kLeaveNative) {
+    const char* method = PrettyTraceMethod(record, epoch, &method_storage);
+    if (event == JniTraceEvent::kEnterNative) {
+      line.Append("jnitrace           [>] enter jni %s\n", method);
+    } else {
+      reader.NextTag();
+      const int64_t duration_ns = reader.GetValue<int64_t>();
+      line.Append("jnitrace           [<] leave jni %s after %" PRId64 " us\n",
+                  method, duration_ns / 1000);
+    }
+    out->Add(line.str());
+    return;
+  }
+  line.Append("jnitrace           [+] JNIEnv->%s\n", JniTrace::GetFunctionName(record.func));
+  // The overhead governor may have left out the arguments, see JniTraceDetail.
+  const bool has_arguments = reader.HasNext();
+  switch (event) {
+    case JniTraceEvent::kGetMethodID: {
+      if (!has_arguments) {
+        line.Append("jnitrace           |= jmethodID        :%p   {%s}\n",
+                    reinterpret_cast<void*>(record.method),
+                    PrettyTraceMethod(record, epoch, &method_storage));
+        break;
+      }
+      reader.NextTag();
+      const char* class_name = reader.GetString(&length);
+      line.Append("jnitrace           |- jclass           :%.*s\n", length, class_name);
+      reader.NextTag();
+      const char* name = reader.GetString(&length);
+      line.Append("jnitrace           |- char*            :%.*s\n", length, name);
+      reader.NextTag();
+      const char* sig = reader.GetString(&length);
+      line.Append("jnitrace           |- char*            :%.*s\n", length, sig);
+      line.Append("jnitrace           |= jmethodID        :%p   {%s}\n",
+                  reinterpret_cast<void*>(record.method),
+                  PrettyTraceMethod(record, epoch, &method_storage));
+      break;
+    }
+    case JniTraceEvent::kCallMethod:
+    case JniTraceEvent::kCallMethodResult:
+      line.Append("jnitrace           |- jmethodID        :%p   {%s}\n",
+                  reinterpret_cast<void*>(record.method),
+                  PrettyTraceMethod(record, epoch, &method_storage));
+      break;
+    case JniTraceEvent::kNewStringUTF: {
+      if (!has_arguments) {
+        break;
+      }
+      reader.NextTag();
+      const char* data = reader.GetString(&length);
+      line.Append("jnitrace           |- char*        : %.*s\n", length, data);
+      break;
+    }
+    case JniTraceEvent::kGetStringUTFChars: {
+      if (!has_arguments) {
+        break;
+      }
+      reader.NextTag();
+      line.Append("jnitrace           |- jboolean*        : %d\n", reader.GetValue<uint8_t>());
+      reader.NextTag();
+      const char* data = reader.GetString(&length);
+      line.Append("jnitrace           |= char*            : %.*s\n", length, data);
+      break;
+    }
+    case JniTraceEvent::kJniCall:
+    case JniTraceEvent::kRegisterNative:
+    case JniTraceEvent::kDetailChange:
+    case JniTraceEvent::kEnterNative:
+    case JniTraceEvent::kLeaveNative:
+    case JniTraceEvent::kPadding:
+      break;
+  }
+  // Remaining fields are the call arguments, then the result and the backtrace.
+  const char* prefix = "|:";
+  while (reader.HasNext()) {
+    if (static_cast<JniTraceField>(*reinterpret_cast<const uint8_t*>(reader.Peek())) ==
+        JniTraceField::kResult) {
+      reader.NextTag();
+      prefix = "|=";
+      continue;
+    }
+    AppendField(&line, &reader, prefix, out);
+  }
+  out->Add(line.str());
+}
+
+// Logs, and resets, what the sampling policies refused since the last flush.
+void LogSamplerCounts(JniTraceThreadState* state, TraceOutput* out) {
+  JniTraceSampler& sampler = state->sampler;
+  for (JniTraceSampler::Site& site : sampler.sites) {
+    if (site.dropped == 0u && site.counted == 0u) {
+      continue;
+    }
+    const JniTraceModule* module = JniTraceModuleIndex::Find(site.pc);
+    const char* module_name = module != nullptr ? module->name.c_str() : "?";
+    const uintptr_t offset = module != nullptr ? site.pc - module->load_bias : site.pc;
+    if (site.dropped != 0u) {
+      out->Printf("jnitrace           /* TID %d */ %u of %u calls to JNIEnv->%s sampled out at "
+                  "%s+0x%" PRIxPTR,
+                  state->tid, site.dropped, site.seen, site.funcname, module_name, offset);
+    }
+    if (site.counted != 0u) {
+      out->Printf("jnitrace           /* TID %d */ %u calls to JNIEnv->%s counted only at "
+                  "%s+0x%" PRIxPTR,
+                  state->tid, site.counted, site.funcname, module_name, offset);
+    }
+    site.dropped = 0u;
+    site.counted = 0u;
+  }
+  if (sampler.evicted_dropped != 0u) {
+    out->Printf("jnitrace           /* TID %d */ %" PRIu64
+                " calls sampled out at evicted call sites",
+                state->tid, sampler.evicted_dropped);
+    sampler.evicted_dropped = 0u;
+  }
+  if (sampler.evicted_counted != 0u) {
+    out->Printf("jnitrace           /* TID %d */ %" PRIu64
+                " calls counted only at evicted call sites",
+                state->tid, sampler.evicted_counted);
+    sampler.evicted_counted = 0u;
+  }
+  if (sampler.rate_limited != 0u) {
+    out->Printf("jnitrace           /* TID %d */ %" PRIu64
+                " calls over the events per second budget",
+                state->tid, sampler.rate_limited);
+    sampler.rate_limited = 0u;
+  }
+}
+
+// Slot of the call site of `funcname` at `call_site`, taking it over from the previous site.
+JniTraceSampler::Site& FindSite(JniTraceSampler* sampler,
+                                const char* funcname,
+                                const void* call_site) {
+  const uintptr_t pc = reinterpret_cast<uintptr_t>(call_site);
+  const size_t index =
+      ((pc ^ reinterpret_cast<uintptr_t>(funcname)) * 0x9e3779b9u >> 8) &
+      (JniTraceSampler::kSites - 1);
+  JniTraceSampler::Site& site = sampler->sites[index];
+  if (site.pc != pc || site.funcname != funcname) {
+    sampler->evicted_dropped += site.dropped;
+    sampler->evicted_counted += site.counted;
+    site = {funcname, pc, 0u, 0u, 0u};
+  }
+  return site;
+}
+
+#if defined(__aarch64__) || defined(__x86_64__)
+
+// Return addresses may carry a pointer authentication code or a top-byte tag.
+ALWAYS_INLINE uintptr_t StripReturnAddress(uintptr_t pc) {
+#if defined(__aarch64__)
+  return pc & ((UINT64_C(1) << 48) - 1u);
+#else
+  return pc;
+#endif
+}
+
+#else
+
+struct UnwindState {
+  uintptr_t* pcs;
+  size_t max_frames;
+  size_t count;
+};
+
+_Unwind_Reason_Code UnwindCallback(_Unwind_Context* context, void* arg) {
+  UnwindState* state = reinterpret_cast<UnwindState*>(arg);
+  const uintptr_t pc = _Unwind_GetIP(context);
+  if (pc == 0u || state->count == state->max_frames) {
+    return _URC_END_OF_STACK;
+  }
+  state->pcs[state->count++] = pc;
+  return _URC_NO_REASON;
+}
+
+#endif
+
+}  // namespace
+
+bool JniTrace::Admit(const char* funcname, const void* call_site) {
+  JniTraceConfigScope config;
+  JniTraceThreadState* state = CurrentThreadState();
+  JniTraceSampler& sampler = state->sampler;
+  if (UNLIKELY(state->governor.detail == JniTraceDetail::kCountersOnly)) {
+    ++FindSite(&sampler, funcname, call_site).counted;
+    return false;
+  }
+  if (config->sampleEvery > 1) {
+    JniTraceSampler::Site& site = FindSite(&sampler, funcname, call_site);
+    const uint32_t first = static_cast<uint32_t>(std::max(config->sampleFirst, 0));
+    const uint32_t seen = site.seen++;
+    if (seen >= first && (seen - first) % static_cast<uint32_t>(config->sampleEvery) != 0u) {
+      ++site.dropped;
+      return false;
+    }
+  }
+  if (config->maxEventsPerSecond > 0) {
+    // Refill lazily, the bucket holds at most one second worth of events.
+    const uint64_t now = NanoTime();
+    const double rate = config->maxEventsPerSecond;
+    sampler.tokens = std::min(rate,
+                              sampler.tokens + (now - sampler.last_refill_ns) * rate / 1e9);
+    sampler.last_refill_ns = now;
+    if (sampler.tokens < 1.0) {
+      ++sampler.rate_limited;
+      return false;
+    }
+    sampler.tokens -= 1.0;
+  }
+  return true;
+}
+
+JniTraceThreadState* JniTrace::CurrentThreadState() {
+  JniTraceThreadState* state = gThreadState.state;
+  if (UNLIKELY(state == nullptr)) {
+    state = new JniTraceThreadState(GetTid());
+    gThreadState.state = state;
+    JniTraceDrain::Register(state);
+  }
+  return state;
+}
+
+uint16_t JniTrace::InternFunctionName(const char* funcname) {
+  size_t index = (reinterpret_cast<uintptr_t>(funcname) >> 3) & (kMaxFunctionNames - 1);
+  for (size_t probe = 0; probe < kMaxFunctionNames; ++probe) {
+    std::atomic<const char*>& slot = gFunctionNames[index];
+    const char* current = slot.load(std::memory_order_acquire);
+    if (current == funcname) {
+      return static_cast<uint16_t>(index);
+    }
+    if (current == nullptr) {
+      if (slot.compare_exchange_strong(current, funcname, std::memory_order_acq_rel)) {
+        JniTraceFlightRecorder::NameFunction(static_cast<uint16_t>(index), funcname);
+        return static_cast<uint16_t>(index);
+      }
+      if (current == funcname) {
+        return static_cast<uint16_t>(index);
+      }
+    }
+    index = (index + 1) & (kMaxFunctionNames - 1);
+  }
+  LOG(FATAL) << "Too many JNI trace function names";
+  UNREACHABLE();
+}
+
+const char* JniTrace::GetFunctionName(uint16_t index) {
+  const char* name = gFunctionNames[index & (kMaxFunctionNames - 1)].load(std::memory_order_acquire);
+  return name != nullptr ? name : "?";
+}
+
+uint32_t JniTrace::UnloadEpoch() {
+  return gUnloadEpoch.load(std::memory_order_acquire);
+}
+
+void JniTrace::OnClassLoaderUnloaded() {
+  gUnloadEpoch.fetch_add(1u, std::memory_order_acq_rel);
+}
+
+JniTraceRecord* JniTrace::BeginRecord(JniTraceThreadState* state,
+                                      JniTraceEvent event,
+                                      const char* funcname,
+                                      uint64_t method) {
+  const uint64_t now = NanoTime();
+  JniTraceConfigScope config;
+  const bool has_triggers = !config.Get()->triggers.IsEmpty();
+  const bool armed = has_triggers && now >= gCaptureUntilNs.load(std::memory_order_relaxed);
+  if (UNLIKELY(armed)) {
+    // Until a trigger fires the ring only keeps the latest preTriggerKB of history.
+    if (state->capturing) {
+      // The capture window just ended, its records go out before history builds up again.
+      state->capturing = false;
+      if (JniTraceDrain::IsActive()) {
+        state->window_end_head = state->buffer.Head();
+        JniTraceDrain::Wake();
+      } else {
+        Flush(state);
+      }
+    }
+    if (!state->holding.load(std::memory_order_relaxed) &&
+        (!JniTraceDrain::IsActive() || state->buffer.Tail() >= state->window_end_head)) {
+      state->holding.store(true, std::memory_order_release);
+    }
+    const size_t keep = std::min(static_cast<size_t>(std::max(config->preTriggerKB, 0)) * KB,
+                                 kJniTraceFlushThreshold / 2);
+    // Trimmed in batches, not on every record.
+    if (state->holding.load(std::memory_order_relaxed) &&
+        !state->buffer.Overwrites() &&
+        state->buffer.Used() > 2 * keep) {
+      std::lock_guard<std::mutex> lock(state->drain_lock);
+      state->buffer.Trim(keep);
+    }
+  } else {
+    // A trigger fired: the history is the start of the capture.
+    state->holding.store(false, std::memory_order_relaxed);
+    state->capturing = has_triggers;
+    // Flight recorder rings are always full and never flushed.
+    if (UNLIKELY(state->buffer.Used() > kJniTraceFlushThreshold) &&
+        !state->buffer.Overwrites()) {
+      if (JniTraceDrain::IsActive()) {
+        JniTraceDrain::Wake();
+      } else {
+        // Amortized: one batch of logcat writes every few thousand events.
+        Flush(state);
+      }
+    }
+  }
+  state->pre_trigger = armed;
+  JniTraceGovernor& governor = state->governor;
+  if (config->maxOverheadPercent > 0) {
+    if (UNLIKELY(now - governor.period_start_ns >= kGovernorPeriodNs)) {
+      GovernOverhead(state, config->maxOverheadPercent, now);
+    }
+    governor.record_start_ns = now;
+  } else {
+    governor.record_start_ns = 0u;
+  }
+  JniTraceRecord* record = state->buffer.Reserve(kJniTraceMaxPayload);
+  if (UNLIKELY(record == nullptr)) {
+    return nullptr;
+  }
+  record->event = static_cast<uint16_t>(event);
+  record->func = InternFunctionName(funcname);
+  record->payload_size = 0;
+  record->tid = static_cast<uint32_t>(state->tid);
+  record->unload_epoch = UnloadEpoch();
+  record->timestamp_ns = now;
+  record->method = method;
+  return record;
+}
+
+void JniTrace::EndRecord(JniTraceThreadState* state,
+                         JniTraceRecord* record,
+                         const JniTracePayloadWriter& writer) {
+  record->payload_size = static_cast<uint16_t>(writer.Size());
+  state->buffer.Commit(record);
+  // Covers formatting the arguments, the backtrace and any flush BeginRecord did.
+  if (state->governor.record_start_ns != 0u) {
+    state->governor.overhead_ns += NanoTime() - state->governor.record_start_ns;
+  }
+}
+
+void JniTrace::GovernOverhead(JniTraceThreadState* state, int max_percent, uint64_t now) {
+  JniTraceGovernor& governor = state->governor;
+  const uint64_t cpu_ns = ThreadCpuNanoTime();
+  if (governor.period_start_ns == 0u) {
+    // First record of the thread.
+    governor.period_start_ns = now;
+    governor.period_start_cpu_ns = cpu_ns;
+    return;
+  }
+  const uint64_t cpu_delta_ns = cpu_ns - governor.period_start_cpu_ns;
+  if (cpu_delta_ns < kGovernorMinCpuNs) {
+    return;
+  }
+  const uint64_t per_mille = std::min<uint64_t>(governor.overhead_ns * 1000u / cpu_delta_ns, 1000u);
+  governor.period_start_ns = now;
+  governor.period_start_cpu_ns = cpu_ns;
+  governor.overhead_ns = 0u;
+  if (per_mille <= static_cast<uint64_t>(max_percent) * 10u ||
+      governor.detail == JniTraceDetail::kCountersOnly) {
+    return;
+  }
+  governor.detail = static_cast<JniTraceDetail>(static_cast<uint8_t>(governor.detail) + 1u);
+  // Written straight into the ring, BeginRecord is what called us.
+  JniTraceRecord* record = state->buffer.Reserve(kJniTraceMaxPayload);
+  if (record == nullptr) {
+    return;
+  }
+  record->event = static_cast<uint16_t>(JniTraceEvent::kDetailChange);
+  record->func = InternFunctionName("OverheadGovernor");
+  record->payload_size = 0;
+  record->tid = static_cast<uint32_t>(state->tid);
+  record->unload_epoch = UnloadEpoch();
+  record->timestamp_ns = now;
+  record->method = 0u;
+  JniTracePayloadWriter writer(record);
+  writer.PutValue(JniTraceField::kInt, static_cast<int32_t>(governor.detail));
+  writer.PutValue(JniTraceField::kInt, static_cast<int32_t>(per_mille));
+  record->payload_size = static_cast<uint16_t>(writer.Size());
+  state->buffer.Commit(record);
+}
+
+size_t JniTrace::Unwind(const JniTraceThreadState* state, uintptr_t* pcs, size_t max_frames) {
+#if defined(__aarch64__) || defined(__x86_64__)
+  // Both ABIs keep {caller frame pointer, return address} at the frame pointer. The walk ends at
+  // the first frame built without frame pointers, in practice the managed frames below the
+  // native method, which is the part of the stack the trace cares about.
+  if (state->stack_end == 0u) {
+    return 0u;
+  }
+  size_t count = 0;
+  uintptr_t fp = reinterpret_cast<uintptr_t>(__builtin_frame_address(0));
+  while (count < max_frames &&
+         fp >= state->stack_begin &&
+         fp <= state->stack_end - 2 * sizeof(uintptr_t) &&
+         IsAligned<sizeof(uintptr_t)>(fp)) {
+    const uintptr_t* frame = reinterpret_cast<const uintptr_t*>(fp);
+    const uintptr_t pc = StripReturnAddress(frame[1]);
+    if (pc == 0u) {
+      break;
+    }
+    pcs[count++] = pc;
+    // Callers are at higher addresses, anything else is a broken chain.
+    if (frame[0] <= fp) {
+      break;
+    }
+    fp = frame[0];
+  }
+  return count;
+#else
+  // Thumb code keeps no usable frame chain, use the EHABI tables through libunwind.
+  UNUSED(state);
+  UnwindState unwind_state = {pcs, max_frames, 0u};
+  _Unwind_Backtrace(UnwindCallback, &unwind_state);
+  return unwind_state.count;
+#endif
+}
+
+void JniTrace::RecordBacktrace(JniTraceThreadState* state, JniTracePayloadWriter* writer) {
+  // Unwinding is most of the cost of a record; history before a trigger goes without, and so do
+  // threads the overhead governor has lowered.
+  if (state->pre_trigger || state->governor.detail >= JniTraceDetail::kNoBacktraces) {
+    return;
+  }
+  uintptr_t pcs[kJniTraceMaxFrames];
+  const size_t count = Unwind(state, pcs, kJniTraceMaxFrames);
+  const uint32_t id = JniTraceStackTable::Intern(pcs, count);
+  if (LIKELY(id != JniTraceStackTable::kInvalidId)) {
+    writer->PutValue(JniTraceField::kStackId, id);
+    if (UNLIKELY(state->buffer.Overwrites()) && JniTraceStackTable::MarkFlightRecorded(id)) {
+      JniTraceFlightRecorder::RecordStack(id, pcs, count);
+    }
+  } else {
+    writer->PutFrames(pcs, count);
+  }
+}
+
+void JniTrace::FlushCurrentThread() {
+  JniTraceThreadState* state = gThreadState.state;
+  // The drain thread picks the records up on its next pass, and nobody reads flight recorder
+  // rings in the process. History before a trigger is only logged once one fires.
+  if (state != nullptr &&
+      !JniTraceDrain::IsActive() &&
+      !state->buffer.Overwrites() &&
+      (!state->holding.load(std::memory_order_relaxed) || IsCapturing())) {
+    Flush(state);
+  }
+}
+
+void JniTrace::Flush(JniTraceThreadState* state) {
+  JniTraceConfigScope config;
+  TraceOutput out(config.Get()->Sink());
+  std::lock_guard<std::mutex> lock(state->drain_lock);
+  const uint32_t epoch = UnloadEpoch();
+  state->buffer.Drain([&](const JniTraceRecord& record) { LogRecord(record, epoch, &out); });
+  uint64_t dropped = state->buffer.TakeDropped();
+  if (dropped != 0u) {
+    out.Printf("jnitrace           /* TID %d */ %" PRIu64 " events dropped", state->tid, dropped);
+  }
+  LogSamplerCounts(state, &out);
+}
+
+bool JniTrace::HasTrigger(JniTraceTriggers::Kind kind) {
+  JniTraceConfigScope config;
+  return config.Get()->triggers.Has(kind);
+}
+
+void JniTrace::CheckTrigger(JniTraceTriggers::Kind kind, std::string_view text) {
+  JniTraceConfigScope config;
+  const JniTraceTriggers& triggers = config.Get()->triggers;
+  if (!triggers.Has(kind)) {
+    return;
+  }
+  const uint64_t now = NanoTime();
+  uint64_t until = gCaptureUntilNs.load(std::memory_order_relaxed);
+  // Rules are not evaluated during a window, a match would not change anything.
+  if (now < until || !triggers.Matches(kind, text)) {
+    return;
+  }
+  const int window_ms = std::max(config->triggerWindowMs, 0);
+  const uint64_t next = now + MsToNs(window_ms);
+  do {
+    if (now < until) {
+      return;  // Another thread fired first.
+    }
+  } while (!gCaptureUntilNs.compare_exchange_weak(until, next, std::memory_order_relaxed));
+  Print("jnitrace trigger %s matched \"%.*s\", capturing for %d ms",
+        JniTraceTriggers::KindName(kind),
+        static_cast<int>(std::min(text.size(), static_cast<size_t>(256))),
+        text.data(),
+        window_ms);
+}
+
+bool JniTrace::IsCapturing() {
+  return NanoTime() < gCaptureUntilNs.load(std::memory_order_relaxed);
+}
+
+void JniTrace::RecordRegisterNative(ArtMethod* method, const void* native_code) {
+  if (!JniTraceFlightRecorder::IsActive()) {
+    return;
+  }
+  JniTraceThreadState* state = CurrentThreadState();
+  if (!state->buffer.Overwrites()) {
+    return;
+  }
+  JniTraceRecord* record = BeginRecord(state,
+                                       JniTraceEvent::kRegisterNative,
+                                       "RegisterNative",
+                                       reinterpret_cast<uint64_t>(method));
+  if (record == nullptr) {
+    return;
+  }
+  JniTracePayloadWriter writer(record);
+  writer.PutValue(JniTraceField::kPointer, reinterpret_cast<uint64_t>(native_code));
+  // The file is read without the process, the method pointer alone names nothing.
+  writer.PutCString(JniTraceField::kString, method->PrettyMethod().c_str());
+  EndRecord(state, record, writer);
+}
+
+void JniTrace::RecordWatchedNative(JniTraceEvent event, ArtMethod* method, uint64_t duration_ns) {
+  const char* funcname = event == JniTraceEvent::kEnterNative ? "JniMethodStart" : "JniMethodEnd";
+  if (!Admit(funcname, method->GetEntryPointFromJni())) {
+    return;
+  }
+  JniTraceThreadState* state = CurrentThreadState();
+  JniTraceRecord* record = BeginRecord(state, event, funcname, reinterpret_cast<uint64_t>(method));
+  if (record == nullptr) {
+    return;
+  }
+  JniTracePayloadWriter writer(record);
+  if (event == JniTraceEvent::kLeaveNative) {
+    writer.PutValue(JniTraceField::kLong, static_cast<int64_t>(duration_ns));
+  }
+  EndRecord(state, record, writer);
+}
+
+void JniTrace::Print(const char* fmt, ...) {
+  JniTraceConfigScope config;
+  LineBuilder line;
+  va_list ap;
+  va_start(ap, fmt);
+  line.AppendV(fmt, ap);
+  va_end(ap);
+  line.Append("\n");
+  config.Get()->Sink()->Write(line.str());
+}
+
+}  // namespace art
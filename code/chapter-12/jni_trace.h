@@ -0,0 +1,1088 @@
+#ifndef ART_RUNTIME_JNI_TRACE_H_
+#define ART_RUNTIME_JNI_TRACE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "base/globals.h"
+#include "base/macros.h"
+#include "base/time_utils.h"
+
+namespace art {
+
+class ArtMethod;
+
+// Binary recorder used by the jnitrace hooks in reflection.cc and jni_trace_interface.cc.
+//
+// Every traced JNIEnv call writes one fixed-layout record into a ring buffer owned by the
+// calling thread. The hot path does no allocation, takes no lock and makes no syscall; the
+// records are only formatted and handed to logcat when the buffer is flushed, which happens
+// when the watched native method returns, when the ring is nearly full or when the thread exits.
+// With PackageItem::drainToFile the rings are instead emptied by JniTraceDrain's daemon thread,
+// and with PackageItem::flightRecorderMB they live in a file and are never emptied at all.
+
+enum class JniTraceEvent : uint16_t {
+  kPadding = 0,        // Filler up to the end of the ring, skipped by readers.
+  kGetMethodID,        // payload: class descriptor, name, signature.
+  kCallMethod,         // payload: one field per argument.
+  kCallMethodResult,   // payload: one field per argument, kResult, then the returned object.
+  kNewStringUTF,       // payload: the utf chars.
+  kGetStringUTFChars,  // payload: is_copy, the returned chars.
+  kJniCall,            // payload: the raw arguments, kResult, the return value if any.
+  kRegisterNative,     // payload: the native code, the method name. Flight recorder only.
+  kDetailChange,       // payload: the new JniTraceDetail and the measured overhead in per mille,
+                       // both kInt.
+  kEnterNative,        // A watched native method was entered. No payload.
+  kLeaveNative,        // A watched native method returned. payload: its duration in ns, kLong.
+};
+
+// Tags of the payload fields. Primitive tags match the dex shorty characters and carry the
+// value with its exact Java type.
+enum class JniTraceField : uint8_t {
+  kBoolean = 'Z',     // u8.
+  kByte = 'B',        // i8.
+  kChar = 'C',        // u16.
+  kShort = 'S',       // i16.
+  kInt = 'I',         // i32.
+  kLong = 'J',        // i64.
+  kFloat = 'F',       // f32.
+  kDouble = 'D',      // f64.
+  kNull = 'N',        // null reference, no data.
+  kObject = 'L',      // u16 length + class descriptor, u32 identity hash.
+  kArray = 'A',       // u16 length + class descriptor, i32 element count,
+                      // u16 length + leading bytes of a primitive array, u32 identity hash.
+  kJavaString = 'j',  // u16 length + modified utf-8 chars (possibly truncated), u32 identity hash.
+  kString = 's',      // u16 length + modified utf-8 chars (possibly truncated).
+  kPointer = 'p',     // u64.
+  kBacktrace = 'T',   // u16 frame count + one u64 pc per frame, symbolized when flushed.
+  kStackId = 'K',     // u32 id of a stack interned in JniTraceStackTable.
+  kResult = 'R',      // no data, the following fields describe the return value.
+};
+
+// Record header. The payload immediately follows the header; `size` covers both and is
+// always a multiple of kJniTraceRecordAlignment.
+struct JniTraceRecord {
+  uint16_t event;
+  uint16_t size;
+  uint16_t func;          // Index into the interned JNIEnv function names.
+  uint16_t payload_size;
+  uint32_t tid;
+  uint32_t unload_epoch;  // JniTrace::UnloadEpoch() when the record was made.
+  uint64_t timestamp_ns;
+  uint64_t method;        // ArtMethod* behind the jmethodID, or 0 if the event has none.
+};
+
+static_assert(sizeof(JniTraceRecord) == 32, "JniTraceRecord layout changed");
+
+static constexpr size_t kJniTraceRecordAlignment = 8;
+// Largest payload a single record may carry.
+static constexpr size_t kJniTraceMaxPayload = 4 * KB - sizeof(JniTraceRecord);
+// Strings are truncated to this many bytes.
+static constexpr size_t kJniTraceMaxString = 256;
+// Bytes of primitive array data kept in a kArray field.
+static constexpr size_t kJniTraceMaxArrayPrefix = 32;
+// Deepest backtrace kept in a record.
+static constexpr size_t kJniTraceMaxFrames = 64;
+
+// Positions of a ring, as the number of bytes ever written and ever released.
+struct JniTraceRingPositions {
+  std::atomic<uint64_t> head{0u};
+  std::atomic<uint64_t> tail{0u};
+};
+
+// Single-producer single-consumer ring of JniTraceRecords. The owning thread is the only
+// producer; readers use Drain() and only ever advance the tail.
+class JniTraceBuffer {
+ public:
+  // Without `data` the ring allocates its memory and keeps its positions itself. With it, the
+  // ring lives in the caller's memory and has no reader in the process; Reserve() then evicts
+  // the oldest records instead of refusing new ones. The flight recorder uses this.
+  explicit JniTraceBuffer(size_t capacity,
+                          uint8_t* data = nullptr,
+                          JniTraceRingPositions* positions = nullptr);
+  ~JniTraceBuffer();
+
+  // Returns room for a record with up to `max_payload` bytes of payload, or null if the ring
+  // cannot take it. The record is not visible to readers until Commit().
+  JniTraceRecord* Reserve(size_t max_payload);
+  void Commit(JniTraceRecord* record);
+
+  // Calls `visitor(const JniTraceRecord&)` for every committed record and releases them.
+  template <typename Visitor>
+  size_t Drain(Visitor&& visitor);
+
+  size_t Used() const {
+    return positions_->head.load(std::memory_order_relaxed) -
+           positions_->tail.load(std::memory_order_relaxed);
+  }
+
+  // Whether this is an evicting ring without readers.
+  bool Overwrites() const {
+    return overwrite_;
+  }
+
+  size_t Capacity() const {
+    return capacity_;
+  }
+
+  uint64_t Head() const {
+    return positions_->head.load(std::memory_order_acquire);
+  }
+
+  uint64_t Tail() const {
+    return positions_->tail.load(std::memory_order_acquire);
+  }
+
+  // Releases the oldest records, without counting them as dropped, until at most `max_used`
+  // bytes are in use. Called by the producer with the drain lock of the ring held.
+  void Trim(size_t max_used);
+
+  uint64_t TakeDropped() {
+    return dropped_.exchange(0, std::memory_order_relaxed);
+  }
+
+ private:
+  // Moves the tail past whole records until it reaches `min_tail`.
+  void Evict(uint64_t tail, uint64_t min_tail);
+
+  const bool overwrite_;
+  uint8_t* const data_;
+  const size_t capacity_;  // Power of two.
+  JniTraceRingPositions own_positions_;
+  JniTraceRingPositions* const positions_;
+  std::atomic<uint64_t> dropped_;
+
+  DISALLOW_COPY_AND_ASSIGN(JniTraceBuffer);
+};
+
+template <typename Visitor>
+size_t JniTraceBuffer::Drain(Visitor&& visitor) {
+  uint64_t tail = positions_->tail.load(std::memory_order_relaxed);
+  const uint64_t head = positions_->head.load(std::memory_order_acquire);
+  size_t count = 0;
+  while (tail < head) {
+    const JniTraceRecord* record =
+        reinterpret_cast<const JniTraceRecord*>(data_ + (tail & (capacity_ - 1)));
+    if (record->event != static_cast<uint16_t>(JniTraceEvent::kPadding)) {
+      visitor(*record);
+      ++count;
+    }
+    tail += record->size;
+  }
+  positions_->tail.store(tail, std::memory_order_release);
+  return count;
+}
+
+// Appends typed fields to the payload of a reserved record. A field that does not fit is dropped
+// together with every later one, so readers never see a partial field.
+class JniTracePayloadWriter {
+ public:
+  JniTracePayloadWriter(uint8_t* begin, size_t capacity)
+      : begin_(begin), pos_(begin), committed_(begin), end_(begin + capacity) {}
+
+  // Writes into the payload area of a record returned by JniTrace::BeginRecord().
+  explicit JniTracePayloadWriter(JniTraceRecord* record)
+      : JniTracePayloadWriter(reinterpret_cast<uint8_t*>(record + 1), kJniTraceMaxPayload) {}
+
+  template <typename T>
+  void PutValue(JniTraceField tag, T value) {
+    BeginField(tag);
+    PutRaw(value);
+    EndField();
+  }
+
+  void PutTag(JniTraceField tag) {
+    BeginField(tag);
+    EndField();
+  }
+
+  // Writes `length` bytes of `data`, truncated to what fits.
+  void PutString(JniTraceField tag, const char* data, size_t length) {
+    BeginField(tag);
+    PutRawString(data, length);
+    EndField();
+  }
+
+  // Writes a null-terminated string, truncated to `max_length` bytes.
+  void PutCString(JniTraceField tag, const char* data, size_t max_length = kJniTraceMaxString) {
+    PutString(tag, data, strnlen(data, max_length));
+  }
+
+  // Writes UTF-16 data as modified UTF-8, truncated to kJniTraceMaxString bytes.
+  void PutUtf16String(JniTraceField tag, const uint16_t* data, size_t length) {
+    BeginField(tag);
+    PutRawUtf16String(data, length);
+    EndField();
+  }
+
+  // Writes a kBacktrace field, dropping the outermost frames that do not fit.
+  void PutFrames(const uintptr_t* pcs, size_t count);
+
+  // Composite fields are written as BeginField(), the parts, then EndField().
+  void BeginField(JniTraceField tag) {
+    PutRaw(static_cast<uint8_t>(tag));
+  }
+
+  template <typename T>
+  void PutRaw(T value) {
+    if (UNLIKELY(overflowed_ || pos_ + sizeof(T) > end_)) {
+      overflowed_ = true;
+      return;
+    }
+    memcpy(pos_, &value, sizeof(T));
+    pos_ += sizeof(T);
+  }
+
+  // u16 length + data, truncated to what fits.
+  void PutRawString(const char* data, size_t length);
+  // u16 length + data converted to modified UTF-8, truncated to kJniTraceMaxString bytes.
+  void PutRawUtf16String(const uint16_t* data, size_t length);
+
+  void EndField() {
+    if (LIKELY(!overflowed_)) {
+      committed_ = pos_;
+    }
+  }
+
+  size_t Size() const {
+    return committed_ - begin_;
+  }
+
+ private:
+  uint8_t* const begin_;
+  uint8_t* pos_;
+  uint8_t* committed_;  // End of the last complete field.
+  uint8_t* const end_;
+  bool overflowed_ = false;
+};
+
+// Reads back what JniTracePayloadWriter produced.
+class JniTracePayloadReader {
+ public:
+  explicit JniTracePayloadReader(const JniTraceRecord& record)
+      : pos_(reinterpret_cast<const uint8_t*>(&record + 1)),
+        end_(pos_ + record.payload_size) {}
+
+  bool HasNext() const {
+    return pos_ < end_;
+  }
+
+  const void* Peek() const {
+    return pos_;
+  }
+
+  JniTraceField NextTag() {
+    return static_cast<JniTraceField>(*pos_++);
+  }
+
+  template <typename T>
+  T GetValue() {
+    T value;
+    memcpy(&value, pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return value;
+  }
+
+  // Returns the string data and stores its length in `length`. The data is not terminated.
+  const char* GetString(uint16_t* length) {
+    *length = GetValue<uint16_t>();
+    const char* data = reinterpret_cast<const char*>(pos_);
+    pos_ += *length;
+    return data;
+  }
+
+ private:
+  const uint8_t* pos_;
+  const uint8_t* const end_;
+};
+
+// What a latency histogram measures.
+enum class JniTraceLatencyKind : uint8_t {
+  kNative,  // A watched native method, keyed by its ArtMethod*.
+  kCall,    // A Call*Method/NewObject made by traced native code, keyed by its jmethodID.
+};
+
+// Log-linear histogram of durations in nanoseconds: exact below 8ns, then 8 linear buckets per
+// power of two up to 2^40ns, so every bucket is within 12.5% of its values. Only the owning
+// thread adds; other threads may read the counts at any time.
+class JniTraceHistogram {
+ public:
+  static constexpr size_t kSubBucketBits = 3;
+  static constexpr size_t kSubBuckets = 1u << kSubBucketBits;
+  static constexpr size_t kMaxExponent = 40;
+  static constexpr size_t kBuckets = (kMaxExponent - kSubBucketBits + 2) * kSubBuckets;
+
+  void Add(uint64_t ns) {
+    std::atomic<uint32_t>& count = counts_[BucketIndex(ns)];
+    count.store(count.load(std::memory_order_relaxed) + 1u, std::memory_order_relaxed);
+  }
+
+  uint32_t Count(size_t bucket) const {
+    return counts_[bucket].load(std::memory_order_relaxed);
+  }
+
+  static size_t BucketIndex(uint64_t ns);
+  // Largest value that falls in `bucket`.
+  static uint64_t BucketUpperBound(size_t bucket);
+
+ private:
+  std::atomic<uint32_t> counts_[kBuckets] = {};
+};
+
+// Latency histograms of one thread, keyed by method, kind and JniTrace::UnloadEpoch(): once a
+// class loader is unloaded its methods' addresses may be reused, and a method seen again starts
+// a new histogram rather than adding to that of whatever was there before.
+class JniTraceLatencyTable {
+ public:
+  static constexpr size_t kCapacity = 256;
+
+  struct Entry {
+    uintptr_t id;
+    JniTraceLatencyKind kind;
+    uint32_t epoch;
+    // Published last; readers skip entries without a histogram.
+    std::atomic<JniTraceHistogram*> histogram;
+  };
+
+  JniTraceLatencyTable();
+  ~JniTraceLatencyTable();
+
+  void Add(JniTraceLatencyKind kind, uintptr_t id, uint64_t ns);
+
+  const Entry* begin() const {
+    return entries_;
+  }
+
+  const Entry* end() const {
+    return entries_ + kCapacity;
+  }
+
+ private:
+  Entry entries_[kCapacity] = {};
+
+  DISALLOW_COPY_AND_ASSIGN(JniTraceLatencyTable);
+};
+
+// Watched native methods deeper than this are not entered; their JNI calls are still traced as
+// those of the watched methods around them.
+static constexpr size_t kJniTraceMaxNativeDepth = 16;
+
+// Nesting depth of watched native methods on the calling thread. Only the owning thread reads
+// or writes it, so checking whether to trace is one TLS load and never touches shared memory.
+extern __thread uint32_t gJniTraceDepth;
+// Quick frame and entry time of each watched native method on the calling thread's stack.
+extern __thread ArtMethod** gJniTraceNativeFrames[kJniTraceMaxNativeDepth];
+extern __thread uint64_t gJniTraceNativeStartNs[kJniTraceMaxNativeDepth];
+
+// Per-thread sampling state, see JniTrace::Admit().
+struct JniTraceSampler {
+  struct Site {
+    const char* funcname;  // Interned like the record names, compared by pointer.
+    uintptr_t pc;          // Return address of the JNIEnv call.
+    uint32_t seen;
+    uint32_t dropped;      // Dropped by sampling since the last flush.
+    uint32_t counted;      // Counted only since the last flush, see JniTraceDetail.
+  };
+
+  // Call sites tracked per thread. A colliding site takes over the slot and restarts its count.
+  static constexpr size_t kSites = 256;
+
+  Site sites[kSites] = {};
+  // Dropped by sampling, or counted only, at sites that were evicted before the next flush.
+  uint64_t evicted_dropped = 0u;
+  uint64_t evicted_counted = 0u;
+  // Token bucket of the per-thread events-per-second budget.
+  double tokens = 0.0;
+  uint64_t last_refill_ns = 0u;
+  uint64_t rate_limited = 0u;
+};
+
+// How much a thread records, lowered step by step by the overhead governor when tracing takes
+// more than PackageItem::maxOverheadPercent of the thread's CPU time. Never raised again.
+enum class JniTraceDetail : uint8_t {
+  kFull,
+  kNoBacktraces,
+  kNoArguments,    // Records name the call and the method only.
+  kCountersOnly,   // No records, calls are counted per call site and logged with the flush.
+};
+
+// Per-thread bookkeeping of the overhead governor, see JniTrace::GovernOverhead.
+struct JniTraceGovernor {
+  JniTraceDetail detail = JniTraceDetail::kFull;
+  // When the record being written was begun, 0 if the thread is not governed.
+  uint64_t record_start_ns = 0u;
+  // Time spent recording, formatting and writing to the sink since the period started.
+  uint64_t overhead_ns = 0u;
+  uint64_t period_start_ns = 0u;
+  uint64_t period_start_cpu_ns = 0u;
+};
+
+// Ring of one thread in the flight recorder file, see jni_trace_flight.cc. The ring data
+// follows the slot header.
+struct JniTraceFlightSlot {
+  std::atomic<uint32_t> tid;          // Owning thread, 0 while the slot is free.
+  uint32_t reserved;
+  std::atomic<uint64_t> released_ns;  // When the previous owner exited.
+  JniTraceRingPositions positions;
+
+  uint8_t* Data();
+};
+
+static constexpr size_t kJniTraceFlightSlotHeaderSize = 64;
+static_assert(sizeof(JniTraceFlightSlot) <= kJniTraceFlightSlotHeaderSize,
+              "JniTraceFlightSlot too large");
+
+inline uint8_t* JniTraceFlightSlot::Data() {
+  return reinterpret_cast<uint8_t*>(this) + kJniTraceFlightSlotHeaderSize;
+}
+
+// Ring size of a thread in the flight recorder.
+static constexpr size_t kJniTraceFlightRingBytes = 256 * KB;
+
+// Flight recorder files kept per package, the new one included. Each process writes its own,
+// so a crashing app would otherwise fill the disk; the oldest go when a process starts.
+static constexpr size_t kJniTraceFlightMaxFiles = 4;
+
+// Per-thread trace state, created on the first traced event of a thread.
+struct JniTraceThreadState {
+  explicit JniTraceThreadState(pid_t tid);
+  ~JniTraceThreadState();
+
+  const pid_t tid;
+  // The thread's ring in the flight recorder, or null if its ring is in memory.
+  JniTraceFlightSlot* const flight_slot;
+  JniTraceBuffer buffer;
+  JniTraceSampler sampler;
+  JniTraceGovernor governor;
+  JniTraceLatencyTable latency;
+  // Bounds of the thread stack, the unwinder never reads outside of them.
+  uintptr_t stack_begin;
+  uintptr_t stack_end;
+  // Held by whoever drains `buffer`, the owner flushing it or the drain thread.
+  std::mutex drain_lock;
+  // The thread is gone and the drain thread owns the state, see JniTraceDrain::Retire.
+  bool exited = false;
+  // Triggered capture, see JniTrace::BeginRecord. The last record was made while the triggers
+  // were armed, and backtraces are left out.
+  bool pre_trigger = false;
+  // The last record was made during a capture window.
+  bool capturing = false;
+  // `buffer` holds pre-trigger history only; nobody drains it until a trigger fires.
+  std::atomic<bool> holding{false};
+  // Head of `buffer` when the last capture window ended. The drain thread still owns what is
+  // before it.
+  uint64_t window_end_head = 0u;
+};
+
+// A set of include and exclude patterns compiled into one automaton, see jni_trace_filter.cc.
+//
+// The spec lists patterns separated by commas, '|' or whitespace; -Xjnitrace takes '|' since
+// its keys are separated by commas. A leading '!' makes a pattern an exclude; '*' and '?' are
+// glob wildcards and make the pattern match the whole text, a pattern without them matches
+// anywhere in the text. A text matches when no exclude matches and either an include matches
+// or there are no includes.
+class JniTraceFilter {
+ public:
+  explicit JniTraceFilter(std::string_view spec);
+
+  bool Matches(std::string_view text) const;
+
+  bool IsEmpty() const {
+    return patterns_.empty();
+  }
+
+ private:
+  struct Pattern {
+    std::string glob;
+    bool exclude;
+    bool literal;  // No wildcards.
+  };
+
+  std::vector<Pattern> patterns_;
+  bool has_includes_ = false;
+  // Byte to automaton input class.
+  uint8_t char_class_[256];
+  size_t num_classes_;
+  // Complete transition table, node * num_classes_ + class.
+  std::vector<int32_t> transitions_;
+  // Patterns whose key ends at each node.
+  std::vector<std::vector<uint32_t>> outputs_;
+  // Patterns without a literal key, checked for every text.
+  std::vector<uint32_t> always_candidates_;
+
+  DISALLOW_COPY_AND_ASSIGN(JniTraceFilter);
+};
+
+// Conditions that start a capture window, see PackageItem::triggers. The spec lists rules
+// separated like JniTraceFilter patterns, each `<call>:<pattern>` where the pattern is matched
+// as a JniTraceFilter against the text of one call:
+//   NewStringUTF:<pattern>       the string created
+//   GetStringUTFChars:<pattern>  the string returned
+//   GetMethodID:<pattern>        name and signature, e.g. "open(Ljava/lang/String;)V"; also
+//                                matches GetStaticMethodID
+//   RegisterNative:<pattern>     the pretty name of the method that gets native code
+class JniTraceTriggers {
+ public:
+  enum Kind : uint8_t {
+    kNewStringUTF,
+    kGetStringUTFChars,
+    kGetMethodID,
+    kRegisterNative,
+    kKinds,
+  };
+
+  explicit JniTraceTriggers(std::string_view spec);
+
+  bool IsEmpty() const {
+    return empty_;
+  }
+
+  // Whether any rule names `kind`; callers skip building the text otherwise.
+  bool Has(Kind kind) const {
+    return filters_[kind] != nullptr;
+  }
+
+  bool Matches(Kind kind, std::string_view text) const {
+    return filters_[kind] != nullptr && filters_[kind]->Matches(text);
+  }
+
+  // Returns false and describes the first bad rule in `error_msg` if `spec` does not parse.
+  static bool Validate(std::string_view spec, std::string* error_msg);
+
+  static const char* KindName(Kind kind);
+
+ private:
+  // Splits `spec` into one filter spec per kind. Returns false at the first bad rule.
+  static bool Split(std::string_view spec, std::string* specs, std::string* error_msg);
+
+  std::unique_ptr<const JniTraceFilter> filters_[kKinds];
+  bool empty_ = true;
+
+  DISALLOW_COPY_AND_ASSIGN(JniTraceTriggers);
+};
+
+// Destination of the formatted trace, see jni_trace_sinks.cc. PackageItem::traceSink picks one:
+//   logcat           the default; lines are batched into few log messages and lines longer
+//                    than a log message are split
+//   file:<path>      append-only memory-mapped file
+//   memfd[:<bytes>]  ring in a memfd that an external collector maps from /proc/<pid>/fd
+//   socket:<path>    Unix stream socket, a leading '@' names an abstract socket
+class JniTraceSink {
+ public:
+  virtual ~JniTraceSink() {}
+
+  // Writes `text`, one or more complete lines. Thread-safe and never waits for a reader, text
+  // that cannot be written is dropped and counted.
+  virtual void Write(const std::string& text) = 0;
+
+  // Returns the sink described by `spec`, opening it on first use. Sinks stay open for the
+  // life of the process; one that cannot be opened falls back to logcat.
+  static JniTraceSink* Get(const std::string& spec);
+};
+
+// A flush hands its text to the sink in batches of about this size.
+static constexpr size_t kJniTraceSinkBatchBytes = 16 * KB;
+
+// Files of the drain thread and of the flight recorder go to <this>/<package>/.
+static constexpr const char* kJniTraceOutputDir = "/data/local/tmp";
+
+// Set once the drain thread runs; from then on it alone empties the rings.
+extern std::atomic<bool> gJniTraceDrainActive;
+
+// Daemon thread that empties the rings of all traced threads in batches and appends them,
+// delta encoded and compressed, to a binary trace file. Traced threads then never format,
+// compress or write; a nearly full ring only wakes the thread. See jni_trace_drain.cc for the
+// file format.
+class JniTraceDrain {
+ public:
+  ALWAYS_INLINE static bool IsActive() {
+    return gJniTraceDrainActive.load(std::memory_order_relaxed);
+  }
+
+  // Starts the drain thread of `package_name` unless it runs already. Does nothing in the
+  // zygote, the thread is started again when the app process publishes its config.
+  static void Start(const std::string& package_name);
+
+  // Asks the drain thread for an early pass. Cheap when a pass is already pending.
+  static void Wake();
+
+  // Makes a new thread state visible to the drain thread.
+  static void Register(JniTraceThreadState* state);
+
+  // Called when the thread of `state` exits. Returns true if the drain thread took over the
+  // state, which it then drains and deletes; otherwise the state is unregistered and the caller
+  // flushes and deletes it.
+  static bool Retire(JniTraceThreadState* state);
+};
+
+// Always-on recorder that keeps the latest records of every thread in a MAP_SHARED file. The
+// rings of the threads traced after it starts live in the file and evict their oldest records
+// when full, so the file holds the last moments before the process died, even of a SIGKILL:
+// the pages belong to the page cache, not to the process. Fatal signals and SIGQUIT only stamp
+// the file header and schedule a writeback. See jni_trace_flight.cc for the layout.
+class JniTraceFlightRecorder {
+ public:
+  // Creates the file of `package_name` with room for `megabytes` of rings and hooks the fatal
+  // signals, after deleting all but the latest kJniTraceFlightMaxFiles - 1 files of earlier
+  // processes. Only the first call does anything, and none does in the zygote.
+  static void Start(const std::string& package_name, size_t megabytes);
+
+  static bool IsActive();
+
+  // Hands a free ring of the file to thread `tid`, preferring the one released longest ago.
+  // Returns null if the recorder is off or every ring is taken.
+  static JniTraceFlightSlot* AcquireSlot(pid_t tid);
+  static void ReleaseSlot(JniTraceFlightSlot* slot);
+
+  // Copies an interned JNIEnv function name, or a stack, into the file so that it can be
+  // decoded without the process.
+  static void NameFunction(uint16_t index, const char* name);
+  static void RecordStack(uint32_t id, const uintptr_t* pcs, size_t count);
+
+  // SIGQUIT, from ClassLinker::DumpForSigQuit: stamps the file and schedules its writeback.
+  static void Checkpoint(std::ostream& os);
+};
+
+// The config file read by the app and by JniTraceConfig::StartWatcher, a JSON array of
+// PackageItem objects.
+static constexpr const char* kJniTraceConfigPath = "/data/local/tmp/config.json";
+
+// jnitrace settings of one package, one entry of kJniTraceConfigPath.
+struct PackageItem {
+  std::string packageName;
+  // Filter specs, see JniTraceFilter.
+  std::string jniModuleName;
+  std::string jniFuncName;
+  bool isRegisterNativePrint = false;
+  bool isJNIMethodPrint = false;
+  // Sampling, all of them 0 records every call.
+  int sampleFirst = 0;         // Every call site records its first K calls,
+  int sampleEvery = 0;         // then 1 in N of the following ones,
+  int maxEventsPerSecond = 0;  // within a per-thread budget of events per second.
+  // Where the trace goes, see JniTraceSink. Empty for logcat.
+  std::string traceSink;
+  // Records are drained by a daemon thread into kJniTraceOutputDir/<package>/trace.bin instead
+  // of being formatted by the traced threads, see JniTraceDrain. traceSink is then used only
+  // for the lines outside of records.
+  bool drainToFile = false;
+  // Megabytes of the latest records kept in kJniTraceOutputDir/<package>/flight.<pid>.bin,
+  // 0 for none. Only the kJniTraceFlightMaxFiles latest processes keep theirs. See
+  // JniTraceFlightRecorder.
+  int flightRecorderMB = 0;
+  // Trigger rules, see JniTraceTriggers. With any, records stay in a pre-trigger ring of
+  // preTriggerKB kilobytes per thread until a rule matches; then that history is kept and
+  // everything is traced in full detail for triggerWindowMs milliseconds, after which the
+  // triggers are armed again.
+  std::string triggers;
+  int triggerWindowMs = 5000;
+  int preTriggerKB = 64;
+  // Share of a thread's CPU time tracing may take before the thread records less, 0 for no
+  // limit. See JniTraceDetail.
+  int maxOverheadPercent = 0;
+};
+
+// Read-side state of one thread. `period` is the grace period the thread was in when it
+// entered its outermost JniTraceConfigScope, 0 outside any scope; publishers wait for it to
+// move on.
+struct JniTraceConfigReader {
+  std::atomic<uint64_t> period{0u};
+  uint32_t nesting = 0u;
+  std::atomic<bool> in_use{false};  // Owned by a live thread.
+  JniTraceConfigReader* next = nullptr;
+};
+
+// The entries of a config file indexed by package name, see jni_trace_config.cc.
+class JniTraceConfigTable {
+ public:
+  JniTraceConfigTable() {}
+
+  // Parses the text of a config file in one pass and builds a perfect hash over the package
+  // names. Returns false, leaving the table empty, if the text is malformed.
+  bool Parse(std::string_view json);
+
+  // Returns the position of the entry of `package_name`, or -1. Hashes the name once and
+  // compares it against a single entry.
+  int32_t Lookup(std::string_view package_name) const;
+
+  const PackageItem* Find(std::string_view package_name) const {
+    const int32_t index = Lookup(package_name);
+    return index >= 0 ? &items_[index] : nullptr;
+  }
+
+  const PackageItem& Get(size_t index) const {
+    return items_[index];
+  }
+
+  size_t Size() const {
+    return items_.size();
+  }
+
+ private:
+  void BuildIndex();
+  bool PlaceBucket(const std::vector<uint32_t>& bucket,
+                   const std::vector<uint64_t>& hashes,
+                   uint32_t* seed);
+
+  // One entry per package name, the first one of the file.
+  std::vector<PackageItem> items_;
+  // Per hash bucket, the seed that maps its names to their slots.
+  std::vector<uint32_t> seeds_;
+  // Position in items_ plus one, 0 when free.
+  std::vector<uint32_t> slots_;
+
+  DISALLOW_COPY_AND_ASSIGN(JniTraceConfigTable);
+};
+
+// One immutable version of the tracing config, see jni_trace_config.cc. Readers reach it
+// through a JniTraceConfigScope; it is freed once a newer version is published and no scope
+// can still see it.
+class JniTraceConfig {
+ public:
+  JniTraceConfig(uint64_t version, const PackageItem& item, bool preloaded = false);
+
+  // Compiles `item` into a new version and makes it current, then waits until no reader can
+  // still see the previous version and frees it. Serialized with other publishers; must not be
+  // called from inside a JniTraceConfigScope, it would wait for itself.
+  static void Publish(const PackageItem& item);
+
+  // Zygote only: parses kJniTraceConfigPath and compiles every entry ahead of the forks, so
+  // that LoadForPackage in the children is one table lookup and touches no file. Starts no
+  // thread.
+  static void Preload();
+
+  // Selects the entry of `package_name`, from the preloaded table or else from
+  // kJniTraceConfigPath, and if there is one publishes it and starts the watcher. Processes
+  // without an entry are left alone, they pay neither for the watcher thread nor for pinned
+  // reads.
+  static void LoadForPackage(const std::string& package_name);
+
+  // Parses the value of -Xjnitrace[:<spec>] into `item`. The spec is a comma separated list of
+  //   package=<name>      PackageItem::packageName, names the latency dump
+  //   filter=<patterns>   PackageItem::jniFuncName, see JniTraceFilter
+  //   module=<patterns>   PackageItem::jniModuleName
+  //   methods=<0|1>       PackageItem::isJNIMethodPrint, on by default
+  //   register=<0|1>      PackageItem::isRegisterNativePrint, on by default
+  //   first=<n>, sample=<n>, rate=<n>
+  //                       PackageItem::sampleFirst, sampleEvery and maxEventsPerSecond
+  //   sink=<sink>         PackageItem::traceSink, see JniTraceSink
+  //   drain=<0|1>         PackageItem::drainToFile
+  //   flight=<megabytes>  PackageItem::flightRecorderMB
+  //   trigger=<rules>     PackageItem::triggers, rules separated by '|'
+  //   window=<ms>, pretrigger=<kilobytes>
+  //                       PackageItem::triggerWindowMs and preTriggerKB
+  //   overhead=<percent>  PackageItem::maxOverheadPercent
+  // Returns false and describes the problem in `error_msg` if the spec is invalid.
+  static bool ParseOptions(std::string_view spec, PackageItem* item, std::string* error_msg);
+
+  // Keeps the config given on the command line until PublishLaunchOptions.
+  static void SetLaunchOptions(const PackageItem& item);
+
+  // Publishes the command line config, if any. Needs an attached thread, the runtime calls it
+  // while registering its natives.
+  static void PublishLaunchOptions();
+
+  // Starts a daemon thread that re-reads kJniTraceConfigPath whenever it changes and publishes
+  // the entry of `package_name`, or tracing off if the entry went away. Only the first call
+  // starts a thread.
+  static void StartWatcher(const std::string& package_name);
+
+  // 0 for the default config, then 1 for the first Publish and growing by one per Publish.
+  const uint64_t version;
+  // Compiled by Preload and shared by the zygote children, never freed.
+  const bool preloaded;
+  const PackageItem item;
+  // Compiled item.jniFuncName and item.jniModuleName.
+  const JniTraceFilter method_filter;
+  const JniTraceFilter module_filter;
+  // Compiled item.triggers.
+  const JniTraceTriggers triggers;
+
+  // The sink of item.traceSink, opened on first use so that the zygote opens none.
+  JniTraceSink* Sink() const;
+
+ private:
+  mutable std::atomic<JniTraceSink*> sink_{nullptr};
+
+  // Tracing off, what readers see before the first Publish. Never freed.
+  static const JniTraceConfig* Default();
+
+  // Grace period bookkeeping of the calling thread, allocated on its first pinned read.
+  static JniTraceConfigReader* RegisterReader();
+
+  friend class JniTraceConfigScope;
+  DISALLOW_COPY_AND_ASSIGN(JniTraceConfig);
+};
+
+extern __thread JniTraceConfigReader* gJniTraceConfigReader;
+extern std::atomic<const JniTraceConfig*> gJniTraceConfig;
+extern std::atomic<uint64_t> gJniTraceConfigPeriod;
+// Whether publishers issue membarrier(), which lets readers get away with a compiler barrier.
+extern std::atomic<bool> gJniTraceConfigMembarrier;
+
+// Pins the current config for the lifetime of the scope. Until the first Publish this is a
+// single acquire load; afterwards entering costs a relaxed store and a compiler barrier and
+// leaving a release store, all on thread-local data. Scopes nest.
+class JniTraceConfigScope {
+ public:
+  ALWAYS_INLINE JniTraceConfigScope() {
+    config_ = gJniTraceConfig.load(std::memory_order_acquire);
+    if (config_ == nullptr) {
+      config_ = JniTraceConfig::Default();
+      return;
+    }
+    reader_ = gJniTraceConfigReader;
+    if (UNLIKELY(reader_ == nullptr)) {
+      reader_ = JniTraceConfig::RegisterReader();
+    }
+    if (reader_->nesting++ == 0u) {
+      reader_->period.store(gJniTraceConfigPeriod.load(std::memory_order_acquire),
+                            std::memory_order_relaxed);
+      // Orders the store above before the load below. Publishers pair this with membarrier()
+      // or, where that is unavailable, we pay for a full fence here.
+      if (LIKELY(gJniTraceConfigMembarrier.load(std::memory_order_relaxed))) {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+      } else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+    }
+    config_ = gJniTraceConfig.load(std::memory_order_acquire);
+  }
+
+  ALWAYS_INLINE ~JniTraceConfigScope() {
+    if (reader_ != nullptr && --reader_->nesting == 0u) {
+      reader_->period.store(0u, std::memory_order_release);
+    }
+  }
+
+  const JniTraceConfig* Get() const {
+    return config_;
+  }
+
+  const PackageItem* operator->() const {
+    return &config_->item;
+  }
+
+ private:
+  const JniTraceConfig* config_;
+  JniTraceConfigReader* reader_ = nullptr;
+
+  DISALLOW_COPY_AND_ASSIGN(JniTraceConfigScope);
+};
+
+// Caches, per native ArtMethod, whether it passes the method and module filters of the current
+// JniTraceConfig: PackageItem::jniFuncName is matched against the pretty method name without
+// its return type and PackageItem::jniModuleName against the path of the module implementing
+// the method. JNI transitions then cost one table probe instead of PrettyMethod() and pattern
+// matching on every call. Verdicts are computed on first sight or when the method is registered.
+//
+// For `native int com.example.Foo.bar(java.lang.String)` the matched text is
+// "com.example.Foo.bar(java.lang.String)":
+//
+//   "com.example.*"           watched
+//   "*.Foo.bar(*)"            watched
+//   "Foo.bar"                 watched, no wildcard, matches anywhere
+//   "com.example.*(int)"      not watched
+//   "com.example.*|!*.Foo.*"  not watched, excluded
+class JniTraceMethodFilter {
+ public:
+  // Returns whether `method` is watched, computing and caching the verdict if needed.
+  static bool IsWatched(ArtMethod* method);
+
+  // Computes the verdict ahead of the first call, used by ClassLinker::RegisterNative. A verdict
+  // cached for an earlier binding of `method` is replaced, the module may have changed.
+  static void Prime(ArtMethod* method);
+
+  // Forgets every verdict, the filter changed.
+  static void Clear();
+
+ private:
+  enum class Verdict {
+    kWatched,
+    kNotWatched,
+    kUnresolved,  // Still bound to the dlsym lookup stub, the module is not known yet.
+  };
+
+  static bool Lookup(ArtMethod* method, bool recompute);
+
+  static Verdict Matches(const JniTraceConfig& config, ArtMethod* method);
+};
+
+// A loaded ELF module, see JniTraceModuleIndex.
+struct JniTraceModule {
+  uintptr_t begin;      // Lowest PT_LOAD address.
+  uintptr_t end;        // End of the highest PT_LOAD segment.
+  uintptr_t load_bias;  // dlpi_addr, offsets are relative to it.
+  std::string name;
+  uint8_t build_id[32];
+  size_t build_id_size;
+};
+
+// Sorted address-range index of the loaded modules, shared by the RegisterNative logging and
+// backtrace symbolization. Implemented in jni_trace_modules.cc.
+class JniTraceModuleIndex {
+ public:
+  // Returns the module containing `addr`, or null. Hits take no lock; returned modules stay
+  // valid for the lifetime of the process.
+  static const JniTraceModule* Find(uintptr_t addr);
+};
+
+// Interned backtraces. A call site usually issues the same JNI calls with the same stack
+// thousands of times, so records carry a 32-bit stack id and each distinct stack is symbolized
+// and logged once. Lookups and inserts are lock-free; stacks are never removed.
+class JniTraceStackTable {
+ public:
+  static constexpr uint32_t kInvalidId = 0xffffffffu;
+
+  // Returns the id of the stack, interning it on first sight, or kInvalidId if the table is
+  // full.
+  static uint32_t Intern(const uintptr_t* pcs, size_t count);
+
+  // Returns the frames of an interned stack and stores their number in `count`.
+  static const uintptr_t* GetFrames(uint32_t id, size_t* count);
+
+  // Returns true for the first caller only, which is the one to log the stack.
+  static bool MarkLogged(uint32_t id);
+
+  // Returns true for the first caller only, which is the one to copy the stack into the flight
+  // recorder.
+  static bool MarkFlightRecorded(uint32_t id);
+};
+
+class JniTrace {
+ public:
+  // Whether the calling thread is inside a watched native method.
+  ALWAYS_INLINE static bool IsTracingCurrentThread() {
+    return gJniTraceDepth != 0u;
+  }
+
+  // Called from JniMethodStart with the quick frame of a watched native method. Returns false
+  // when the method is too deep to be entered.
+  ALWAYS_INLINE static bool EnterWatchedNative(ArtMethod** frame) {
+    if (gJniTraceDepth >= kJniTraceMaxNativeDepth) {
+      return false;
+    }
+    gJniTraceNativeFrames[gJniTraceDepth] = frame;
+    gJniTraceNativeStartNs[gJniTraceDepth] = NanoTime();
+    ++gJniTraceDepth;
+    RecordWatchedNative(JniTraceEvent::kEnterNative, *frame, 0u);
+    return true;
+  }
+
+  // Called from every JniMethodEnd variant with the quick frame of the returning native method.
+  // Leaves it if EnterWatchedNative entered that frame and returns the method, or null. Whether
+  // it was watched is decided by the entry alone: a config applied or a filter cleared while the
+  // method ran must not leave the thread tracing. May run before GoToRunnable, so it records
+  // nothing: the caller passes the method and `duration_ns` to RecordWatchedNative once it is
+  // runnable, where a flush can name methods.
+  ALWAYS_INLINE static ArtMethod* ExitWatchedNative(ArtMethod** frame, uint64_t* duration_ns) {
+    if (LIKELY(gJniTraceDepth == 0u) || gJniTraceNativeFrames[gJniTraceDepth - 1u] != frame) {
+      return nullptr;
+    }
+    --gJniTraceDepth;
+    ArtMethod* method = *frame;
+    *duration_ns = NanoTime() - gJniTraceNativeStartNs[gJniTraceDepth];
+    RecordLatency(JniTraceLatencyKind::kNative, reinterpret_cast<uintptr_t>(method), *duration_ns);
+    return method;
+  }
+
+  // Records a kEnterNative or kLeaveNative into the calling thread's ring. Admitted like JNI
+  // calls, with the native code of `method` as the call site.
+  static void RecordWatchedNative(JniTraceEvent event, ArtMethod* method, uint64_t duration_ns);
+
+  // Adds one duration to the calling thread's histogram of (`kind`, `id`).
+  static void RecordLatency(JniTraceLatencyKind kind, uintptr_t id, uint64_t ns);
+
+  // Merges the histograms of all threads, live and exited, and prints count, p50, p90, p99 and
+  // max per method. Also writes the same text next to the app data, or under
+  // kJniTraceOutputDir/<pid> for a process without a package name. Needs the mutator lock and
+  // a reader lock of Locks::classlinker_classes_lock_ to name the methods.
+  static void DumpLatency(std::ostream& os);
+
+  // Applies the sampling policies of PackageItem to one JNIEnv call made from `call_site`.
+  // Returns whether the call is recorded; refused calls are only counted and the counts are
+  // logged with the next flush.
+  static bool Admit(const char* funcname, const void* call_site);
+
+  // State of the calling thread, allocating it on first use.
+  static JniTraceThreadState* CurrentThreadState();
+
+  // Starts a record for `event`. Returns null if the ring is full, in which case the event is
+  // only counted.
+  static JniTraceRecord* BeginRecord(JniTraceThreadState* state,
+                                     JniTraceEvent event,
+                                     const char* funcname,
+                                     uint64_t method);
+  static void EndRecord(JniTraceThreadState* state,
+                        JniTraceRecord* record,
+                        const JniTracePayloadWriter& writer);
+
+  // Whether records of `state` carry the call arguments; callers skip building them otherwise.
+  ALWAYS_INLINE static bool RecordsArguments(const JniTraceThreadState* state) {
+    return state->governor.detail < JniTraceDetail::kNoArguments;
+  }
+
+  // Appends the id of the calling thread's stack, or the raw pcs if it cannot be interned.
+  // Nothing is symbolized here, frame names are only looked up when the stack is first flushed.
+  static void RecordBacktrace(JniTraceThreadState* state, JniTracePayloadWriter* writer);
+
+  // Whether the current config has trigger rules for `kind`. Cheap, callers test it before
+  // building the text for CheckTrigger.
+  static bool HasTrigger(JniTraceTriggers::Kind kind);
+
+  // Starts a capture window of PackageItem::triggerWindowMs if `text` matches a rule for `kind`
+  // and no window is running yet.
+  static void CheckTrigger(JniTraceTriggers::Kind kind, std::string_view text);
+
+  // Whether a capture window is running.
+  static bool IsCapturing();
+
+  // Records a RegisterNative of `method` to `native_code` into the flight recorder. Rings in
+  // memory get the text line of ClassLinker::RegisterNative instead.
+  static void RecordRegisterNative(ArtMethod* method, const void* native_code);
+
+  // Installs or removes the instrumented JNIEnv function table, see jni_trace_interface.cc.
+  static void SetNativeInterfaceInstalled(bool installed);
+
+  // Formats one line and writes it to the sink of the current config.
+  static void Print(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+  // Formats and logs every pending record of the calling thread.
+  static void FlushCurrentThread();
+
+  // Returns the name interned under `index` by BeginRecord.
+  static const char* GetFunctionName(uint16_t index);
+
+  // Number of class loaders unloaded so far. The method of a record made before an unload may
+  // point to freed memory, or to a method allocated there since.
+  static uint32_t UnloadEpoch();
+  // Called by ClassLinker::CleanupClassLoaders, under the writer lock of
+  // Locks::classlinker_classes_lock_, for each loader it is about to free, and again by
+  // ClassLinker::DeleteClassLoader before it frees the LinearAlloc of the loader. A reader that
+  // holds the lock and sees the epoch of a record can use the record's method.
+  static void OnClassLoaderUnloaded();
+
+ private:
+  // Walks the frame records of the calling thread into `pcs`. Reentrant, takes no lock and
+  // raises no signal.
+  static size_t Unwind(const JniTraceThreadState* state, uintptr_t* pcs, size_t max_frames);
+
+  // Once per period, compares the time the thread spent tracing with its CPU time and lowers
+  // its detail by one step if the share is over `max_percent`. Each step is recorded.
+  static void GovernOverhead(JniTraceThreadState* state, int max_percent, uint64_t now);
+
+  static uint16_t InternFunctionName(const char* funcname);
+  static void Flush(JniTraceThreadState* state);
+};
+
+}  // namespace art
+
+#endif  // ART_RUNTIME_JNI_TRACE_H_
@@ -0,0 +1,905 @@
+#include <errno.h>
+#include <linux/membarrier.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "android-base/file.h"
+#include "android-base/macros.h"
+#include "android-base/parseint.h"
+#include "base/bit_utils.h"
+#include "base/logging.h"
+#include "jni_trace.h"
+#include "runtime.h"
+
+namespace art {
+
+// Versioned tracing config.
+//
+// Each version is an immutable JniTraceConfig published through an atomic pointer, so readers
+// never take a lock and a new version can be swapped in while JNI calls are being traced. Old
+// versions are reclaimed RCU style: every thread that pins a version records the grace period
+// it entered in, and a publisher frees the previous version once every thread has left the
+// scope it pinned it in. Readers order their announcement against the pointer load with only a
+// compiler barrier; the publisher issues membarrier() to make that a full barrier on every CPU
+// running one of our threads.
+//
+// The config file is read natively: the whole file is decoded in one pass straight into
+// PackageItems and indexed by a perfect hash over the package names. The zygote does this once
+// and compiles every entry, so a forked app selects its version with one lookup when it is
+// specialized. A watcher thread then re-reads the file whenever it changes, so tracing can be
+// switched on, off or refiltered in a running process.
+
+__thread JniTraceConfigReader* gJniTraceConfigReader = nullptr;
+std::atomic<const JniTraceConfig*> gJniTraceConfig{nullptr};
+std::atomic<uint64_t> gJniTraceConfigPeriod{1u};
+std::atomic<bool> gJniTraceConfigMembarrier{false};
+
+namespace {
+
+// How often a publisher re-checks a reader that is still in an old grace period.
+static constexpr useconds_t kGracePeriodPollUs = 100;
+// How often the watcher checks the file when it cannot watch it.
+static constexpr unsigned int kWatcherPollSeconds = 2;
+static constexpr uint32_t kWatchMask = IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+// Nesting limit of values skipped by the JSON reader.
+static constexpr size_t kMaxJsonDepth = 64;
+// Seeds tried per bucket of the package name perfect hash before the table is made sparser.
+static constexpr uint32_t kMaxSeed = 1u << 16;
+
+std::mutex gPublishLock;
+// Every reader ever registered; records of exited threads are reused, never freed.
+std::atomic<JniTraceConfigReader*> gReaders{nullptr};
+pthread_key_t gReaderKey;
+pthread_once_t gReaderKeyOnce = PTHREAD_ONCE_INIT;
+
+void ReleaseReader(void* arg) {
+  JniTraceConfigReader* reader = reinterpret_cast<JniTraceConfigReader*>(arg);
+  reader->nesting = 0u;
+  reader->period.store(0u, std::memory_order_release);
+  gJniTraceConfigReader = nullptr;
+  reader->in_use.store(false, std::memory_order_release);
+}
+
+void CreateReaderKey() {
+  CHECK_EQ(pthread_key_create(&gReaderKey, ReleaseReader), 0);
+}
+
+bool RegisterMembarrier() {
+  if (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) != 0) {
+    PLOG(INFO) << "jnitrace config readers use full fences, no private expedited membarrier";
+    return false;
+  }
+  return true;
+}
+
+// Returns once no thread can still see a version unpublished before the call.
+void WaitForReaders() {
+  // Pairs with the compiler barrier of JniTraceConfigScope: a reader whose announcement we do
+  // not see below is ordered after the publication and loads the new version.
+  if (gJniTraceConfigMembarrier.load(std::memory_order_relaxed)) {
+    if (syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) != 0) {
+      PLOG(FATAL) << "membarrier";
+    }
+  } else {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+  // Readers entering from now on announce the new period and need not be waited for.
+  const uint64_t period = gJniTraceConfigPeriod.load(std::memory_order_relaxed) + 1u;
+  gJniTraceConfigPeriod.store(period, std::memory_order_release);
+  for (JniTraceConfigReader* reader = gReaders.load(std::memory_order_acquire);
+       reader != nullptr;
+       reader = reader->next) {
+    while (true) {
+      const uint64_t seen = reader->period.load(std::memory_order_acquire);
+      if (seen == 0u || seen == period) {
+        break;
+      }
+      usleep(kGracePeriodPollUs);
+    }
+  }
+}
+
+// Pull reader over the text of a config file. Values are converted as they are read, nothing
+// is built for the parts of the file that are skipped.
+class JsonReader {
+ public:
+  explicit JsonReader(std::string_view text) : text_(text) {}
+
+  bool Consume(char c) {
+    SkipSpace();
+    if (pos_ < text_.size() && text_[pos_] == c) {
+      ++pos_;
+      return true;
+    }
+    return false;
+  }
+
+  // Reads a string, or null as the empty string.
+  bool ReadString(std::string* out) {
+    out->clear();
+    if (ConsumeLiteral("null")) {
+      return true;
+    }
+    if (!Consume('"')) {
+      return false;
+    }
+    while (pos_ < text_.size()) {
+      const char c = text_[pos_++];
+      if (c == '"') {
+        return true;
+      }
+      if (c != '\\') {
+        out->push_back(c);
+        continue;
+      }
+      if (pos_ == text_.size()) {
+        return false;
+      }
+      switch (text_[pos_++]) {
+        case '"': out->push_back('"'); break;
+        case '\\': out->push_back('\\'); break;
+        case '/': out->push_back('/'); break;
+        case 'b': out->push_back('\b'); break;
+        case 'f': out->push_back('\f'); break;
+        case 'n': out->push_back('\n'); break;
+        case 'r': out->push_back('\r'); break;
+        case 't': out->push_back('\t'); break;
+        case 'u': {
+          uint32_t code_point;
+          if (!ReadHex4(&code_point)) {
+            return false;
+          }
+          if (code_point >= 0xd800u && code_point < 0xdc00u) {
+            uint32_t low;
+            if (!Consume('\\') || !Consume('u') || !ReadHex4(&low) ||
+                low < 0xdc00u || low >= 0xe000u) {
+              return false;
+            }
+            code_point = 0x10000u + ((code_point - 0xd800u) << 10) + (low - 0xdc00u);
+          }
+          AppendUtf8(code_point, out);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    return false;
+  }
+
+  // Reads a number, truncated and clamped to int, or null as 0.
+  bool ReadInt(int* out) {
+    *out = 0;
+    if (ConsumeLiteral("null")) {
+      return true;
+    }
+    SkipSpace();
+    const bool negative = pos_ < text_.size() && text_[pos_] == '-';
+    if (negative) {
+      ++pos_;
+    }
+    const size_t begin = pos_;
+    int64_t value = 0;
+    while (pos_ < text_.size() && text_[pos_] >= '0' && text_[pos_] <= '9') {
+      value = std::min<int64_t>(value * 10 + (text_[pos_++] - '0'), INT32_MAX);
+    }
+    if (pos_ == begin) {
+      return false;
+    }
+    // Fraction and exponent.
+    while (pos_ < text_.size() && strchr(".eE+-0123456789", text_[pos_]) != nullptr) {
+      ++pos_;
+    }
+    *out = static_cast<int>(negative ? -value : value);
+    return true;
+  }
+
+  // Reads true or false, a number as its truth value, or null as false.
+  bool ReadBool(bool* out) {
+    int value;
+    if (ConsumeLiteral("true")) {
+      *out = true;
+    } else if (ConsumeLiteral("false")) {
+      *out = false;
+    } else if (ReadInt(&value)) {
+      *out = value != 0;
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  bool SkipValue(size_t depth = 0u) {
+    if (depth == kMaxJsonDepth) {
+      return false;
+    }
+    SkipSpace();
+    if (pos_ == text_.size()) {
+      return false;
+    }
+    std::string string;
+    int number;
+    switch (text_[pos_]) {
+      case '"':
+        return ReadString(&string);
+      case '{':
+      case '[': {
+        const char close = text_[pos_] == '{' ? '}' : ']';
+        ++pos_;
+        if (Consume(close)) {
+          return true;
+        }
+        do {
+          if (close == '}' && (!ReadString(&string) || !Consume(':'))) {
+            return false;
+          }
+          if (!SkipValue(depth + 1u)) {
+            return false;
+          }
+        } while (Consume(','));
+        return Consume(close);
+      }
+      default:
+        return ConsumeLiteral("true") || ConsumeLiteral("false") || ReadInt(&number);
+    }
+  }
+
+ private:
+  void SkipSpace() {
+    while (pos_ < text_.size() &&
+           (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\r' ||
+            text_[pos_] == '\n')) {
+      ++pos_;
+    }
+  }
+
+  bool ConsumeLiteral(std::string_view literal) {
+    SkipSpace();
+    if (text_.substr(pos_, literal.size()) != literal) {
+      return false;
+    }
+    pos_ += literal.size();
+    return true;
+  }
+
+  bool ReadHex4(uint32_t* out) {
+    if (text_.size() - pos_ < 4u) {
+      return false;
+    }
+    *out = 0u;
+    for (size_t i = 0; i < 4u; ++i) {
+      const char c = text_[pos_++];
+      uint32_t digit;
+      if (c >= '0' && c <= '9') {
+        digit = c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        digit = c - 'a' + 10;
+      } else if (c >= 'A' && c <= 'F') {
+        digit = c - 'A' + 10;
+      } else {
+        return false;
+      }
+      *out = (*out << 4) | digit;
+    }
+    return true;
+  }
+
+  static void AppendUtf8(uint32_t code_point, std::string* out) {
+    if (code_point < 0x80u) {
+      out->push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800u) {
+      out->push_back(static_cast<char>(0xc0u | (code_point >> 6)));
+      out->push_back(static_cast<char>(0x80u | (code_point & 0x3fu)));
+    } else if (code_point < 0x10000u) {
+      out->push_back(static_cast<char>(0xe0u | (code_point >> 12)));
+      out->push_back(static_cast<char>(0x80u | ((code_point >> 6) & 0x3fu)));
+      out->push_back(static_cast<char>(0x80u | (code_point & 0x3fu)));
+    } else {
+      out->push_back(static_cast<char>(0xf0u | (code_point >> 18)));
+      out->push_back(static_cast<char>(0x80u | ((code_point >> 12) & 0x3fu)));
+      out->push_back(static_cast<char>(0x80u | ((code_point >> 6) & 0x3fu)));
+      out->push_back(static_cast<char>(0x80u | (code_point & 0x3fu)));
+    }
+  }
+
+  std::string_view text_;
+  size_t pos_ = 0u;
+};
+
+// Reads one object of the config array. Unknown fields are skipped.
+bool ReadPackageItem(JsonReader* reader, PackageItem* item) {
+  if (!reader->Consume('{')) {
+    return false;
+  }
+  if (reader->Consume('}')) {
+    return true;
+  }
+  std::string key;
+  do {
+    if (!reader->ReadString(&key) || !reader->Consume(':')) {
+      return false;
+    }
+    bool ok;
+    if (key == "packageName") {
+      ok = reader->ReadString(&item->packageName);
+    } else if (key == "jniModuleName") {
+      ok = reader->ReadString(&item->jniModuleName);
+    } else if (key == "jniFuncName") {
+      ok = reader->ReadString(&item->jniFuncName);
+    } else if (key == "isRegisterNativePrint") {
+      ok = reader->ReadBool(&item->isRegisterNativePrint);
+    } else if (key == "isJNIMethodPrint") {
+      ok = reader->ReadBool(&item->isJNIMethodPrint);
+    } else if (key == "sampleFirst") {
+      ok = reader->ReadInt(&item->sampleFirst);
+    } else if (key == "sampleEvery") {
+      ok = reader->ReadInt(&item->sampleEvery);
+    } else if (key == "maxEventsPerSecond") {
+      ok = reader->ReadInt(&item->maxEventsPerSecond);
+    } else if (key == "traceSink") {
+      ok = reader->ReadString(&item->traceSink);
+    } else if (key == "drainToFile") {
+      ok = reader->ReadBool(&item->drainToFile);
+    } else if (key == "flightRecorderMB") {
+      ok = reader->ReadInt(&item->flightRecorderMB);
+    } else if (key == "triggers") {
+      ok = reader->ReadString(&item->triggers);
+    } else if (key == "triggerWindowMs") {
+      ok = reader->ReadInt(&item->triggerWindowMs);
+    } else if (key == "preTriggerKB") {
+      ok = reader->ReadInt(&item->preTriggerKB);
+    } else if (key == "maxOverheadPercent") {
+      ok = reader->ReadInt(&item->maxOverheadPercent);
+    } else {
+      ok = reader->SkipValue();
+    }
+    if (!ok) {
+      return false;
+    }
+  } while (reader->Consume(','));
+  return reader->Consume('}');
+}
+
+bool ReadConfigFile(JniTraceConfigTable* table) {
+  std::string json;
+  if (!android::base::ReadFileToString(kJniTraceConfigPath, &json)) {
+    PLOG(WARNING) << "Could not read " << kJniTraceConfigPath;
+    return false;
+  }
+  if (!table->Parse(json)) {
+    LOG(WARNING) << "Ignoring malformed " << kJniTraceConfigPath;
+    return false;
+  }
+  return true;
+}
+
+uint64_t HashPackageName(std::string_view name) {
+  uint64_t hash = UINT64_C(0xcbf29ce484222325);
+  for (char c : name) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * UINT64_C(0x100000001b3);
+  }
+  // FNV leaves the high bits poorly mixed for names that differ only at the end.
+  hash = (hash ^ (hash >> 33)) * UINT64_C(0xff51afd7ed558ccd);
+  hash = (hash ^ (hash >> 33)) * UINT64_C(0xc4ceb9fe1a85ec53);
+  return hash ^ (hash >> 33);
+}
+
+size_t BucketOf(uint64_t hash, size_t num_buckets) {
+  return (hash >> 32) & (num_buckets - 1u);
+}
+
+size_t SlotOf(uint64_t hash, uint32_t seed, size_t num_slots) {
+  const uint64_t mixed = (hash ^ (seed * UINT64_C(0x9e3779b97f4a7c15))) *
+                         UINT64_C(0xff51afd7ed558ccd);
+  return (mixed ^ (mixed >> 32)) & (num_slots - 1u);
+}
+
+// What identifies one version of the config file.
+struct ConfigFileStamp {
+  bool exists = false;
+  dev_t dev = 0;
+  ino_t ino = 0;
+  off_t size = 0;
+  int64_t mtime_ns = 0;
+
+  bool operator==(const ConfigFileStamp& other) const {
+    return exists == other.exists &&
+           dev == other.dev &&
+           ino == other.ino &&
+           size == other.size &&
+           mtime_ns == other.mtime_ns;
+  }
+};
+
+ConfigFileStamp StatConfigFile() {
+  ConfigFileStamp stamp;
+  struct stat st;
+  if (stat(kJniTraceConfigPath, &st) == 0) {
+    stamp.exists = true;
+    stamp.dev = st.st_dev;
+    stamp.ino = st.st_ino;
+    stamp.size = st.st_size;
+    stamp.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  }
+  return stamp;
+}
+
+// Publishes the entry of `package_name` if the file changed since `last`. A missing file turns
+// tracing off; a malformed one, such as a file caught half written, keeps the current version.
+void ReloadIfChanged(const std::string& package_name, ConfigFileStamp* last) {
+  const ConfigFileStamp stamp = StatConfigFile();
+  if (stamp == *last) {
+    return;
+  }
+  *last = stamp;
+  JniTraceConfigTable table;
+  if (stamp.exists && !ReadConfigFile(&table)) {
+    return;
+  }
+  const PackageItem* entry = table.Find(package_name);
+  PackageItem off;
+  off.packageName = package_name;
+  JniTraceConfig::Publish(entry != nullptr ? *entry : off);
+}
+
+// Blocks until the watch on the file goes away, reloading on every change. Returns false if
+// the inotify descriptor is no longer usable.
+bool WatchConfigFile(int inotify_fd,
+                     int watch,
+                     const std::string& package_name,
+                     ConfigFileStamp* last) {
+  while (true) {
+    alignas(inotify_event) char events[4 * KB];
+    const ssize_t size = TEMP_FAILURE_RETRY(read(inotify_fd, events, sizeof(events)));
+    if (size <= 0) {
+      PLOG(WARNING) << "jnitrace config watcher falls back to polling";
+      return false;
+    }
+    bool removed = false;
+    for (const char* pos = events; pos < events + size; ) {
+      const inotify_event* event = reinterpret_cast<const inotify_event*>(pos);
+      // Events of an earlier watch may still be queued.
+      removed |= event->wd == watch &&
+                 (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) != 0u;
+      pos += sizeof(inotify_event) + event->len;
+    }
+    if (removed) {
+      // Replaced or deleted; the caller re-arms on the new file and reloads.
+      return true;
+    }
+    ReloadIfChanged(package_name, last);
+  }
+}
+
+struct WatcherArgs {
+  std::string package_name;
+  // The file as seen by the version the watcher starts from.
+  ConfigFileStamp baseline;
+};
+
+void* WatchConfig(void* arg) {
+  std::unique_ptr<WatcherArgs> args(reinterpret_cast<WatcherArgs*>(arg));
+  const std::string& package_name = args->package_name;
+  Runtime* runtime = Runtime::Current();
+  // Publishing swaps the JNIEnv tables of all threads, which needs an attached thread.
+  CHECK(runtime->AttachCurrentThread("JniTraceConfig",
+                                     /* as_daemon= */ true,
+                                     runtime->GetSystemThreadGroup(),
+                                     /* create_peer= */ !runtime->IsAotCompiler()));
+  ConfigFileStamp last = args->baseline;
+  int inotify_fd = inotify_init1(IN_CLOEXEC);
+  while (true) {
+    const int watch =
+        inotify_fd >= 0 ? inotify_add_watch(inotify_fd, kJniTraceConfigPath, kWatchMask) : -1;
+    // Catches changes made while nothing was watched.
+    ReloadIfChanged(package_name, &last);
+    if (watch < 0) {
+      // No file yet, or SELinux denies watching it.
+      sleep(kWatcherPollSeconds);
+      continue;
+    }
+    if (!WatchConfigFile(inotify_fd, watch, package_name, &last)) {
+      close(inotify_fd);
+      inotify_fd = -1;
+      continue;
+    }
+    // A moved file keeps its watch, drop it before watching the path again.
+    inotify_rm_watch(inotify_fd, watch);
+  }
+  return nullptr;
+}
+
+void StartWatcherThread(const std::string& package_name, const ConfigFileStamp& baseline) {
+  static std::atomic<bool> started{false};
+  if (started.exchange(true)) {
+    return;
+  }
+  WatcherArgs* args = new WatcherArgs{package_name, baseline};
+  pthread_t thread;
+  const int rc = pthread_create(&thread, nullptr, WatchConfig, args);
+  if (rc != 0) {
+    errno = rc;
+    PLOG(WARNING) << "Could not start the jnitrace config watcher";
+    delete args;
+    return;
+  }
+  pthread_detach(thread);
+}
+
+// Makes `next` current and retires `previous`. Needs gPublishLock.
+void Install(const JniTraceConfig* next, const JniTraceConfig* previous) {
+  if (previous == nullptr) {
+    // Readers check this only after seeing a config, the release store below orders it.
+    gJniTraceConfigMembarrier.store(RegisterMembarrier(), std::memory_order_relaxed);
+  }
+  gJniTraceConfig.store(next, std::memory_order_release);
+  if (previous != nullptr) {
+    WaitForReaders();
+    if (!previous->preloaded) {
+      delete previous;
+    }
+  }
+  // No verdict of the previous version can be inserted any more, see IsWatched.
+  JniTraceMethodFilter::Clear();
+  JniTrace::SetNativeInterfaceInstalled(next->item.isJNIMethodPrint);
+  if (next->item.drainToFile) {
+    JniTraceDrain::Start(next->item.packageName);
+  }
+  if (next->item.flightRecorderMB > 0) {
+    JniTraceFlightRecorder::Start(next->item.packageName, next->item.flightRecorderMB);
+  }
+  LOG(INFO) << "jnitrace config version " << next->version << " for " << next->item.packageName
+            << ": isJNIMethodPrint=" << next->item.isJNIMethodPrint
+            << " isRegisterNativePrint=" << next->item.isRegisterNativePrint
+            << (next->preloaded ? " (preloaded)" : "");
+}
+
+// Parsed and compiled by the zygote, inherited by every app process it forks.
+struct PreloadedConfigs {
+  JniTraceConfigTable table;
+  // Compiled table entries, by position.
+  std::vector<const JniTraceConfig*> configs;
+  ConfigFileStamp stamp;
+};
+
+const PreloadedConfigs* gPreloadedConfigs = nullptr;
+
+// -Xjnitrace config, until the runtime can publish it.
+const PackageItem* gLaunchOptions = nullptr;
+
+bool ParseOptionBool(std::string_view value, bool* out) {
+  if (value == "1" || value == "true") {
+    *out = true;
+  } else if (value == "0" || value == "false") {
+    *out = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool ParseOptionInt(std::string_view value, int* out) {
+  return android::base::ParseInt(std::string(value), out, 0);
+}
+
+}  // namespace
+
+JniTraceConfig::JniTraceConfig(uint64_t version_in, const PackageItem& item_in, bool preloaded_in)
+    : version(version_in),
+      preloaded(preloaded_in),
+      item(item_in),
+      method_filter(item_in.jniFuncName),
+      module_filter(item_in.jniModuleName),
+      triggers(item_in.triggers) {}
+
+void JniTraceConfig::Publish(const PackageItem& item) {
+  std::lock_guard<std::mutex> lock(gPublishLock);
+  const JniTraceConfig* previous = gJniTraceConfig.load(std::memory_order_relaxed);
+  const uint64_t version = previous != nullptr ? previous->version + 1u : 1u;
+  Install(new JniTraceConfig(version, item), previous);
+}
+
+bool JniTraceConfigTable::Parse(std::string_view json) {
+  items_.clear();
+  seeds_.clear();
+  slots_.clear();
+  std::vector<PackageItem> items;
+  JsonReader reader(json);
+  if (!reader.Consume('[')) {
+    return false;
+  }
+  if (!reader.Consume(']')) {
+    do {
+      items.emplace_back();
+      if (!ReadPackageItem(&reader, &items.back())) {
+        return false;
+      }
+    } while (reader.Consume(','));
+    if (!reader.Consume(']')) {
+      return false;
+    }
+  }
+  // The first of duplicate entries wins, as with the linear match of the Java side.
+  std::unordered_set<std::string_view> names;
+  for (const PackageItem& item : items) {
+    if (names.insert(item.packageName).second) {
+      items_.push_back(item);
+    }
+  }
+  BuildIndex();
+  return true;
+}
+
+// Hash and displace: names are grouped into buckets by their hash, then, largest bucket first,
+// each bucket gets the first seed that sends all of its names to free slots. A lookup hashes
+// the name once and reads one seed and one slot.
+void JniTraceConfigTable::BuildIndex() {
+  // At most half full, which keeps the seed search short.
+  size_t num_slots = RoundUpToPowerOfTwo(std::max<size_t>(items_.size() * 2u, 1u));
+  const size_t num_buckets = RoundUpToPowerOfTwo(std::max<size_t>(items_.size() / 2u, 1u));
+  std::vector<uint64_t> hashes(items_.size());
+  std::vector<std::vector<uint32_t>> buckets(num_buckets);
+  for (size_t i = 0; i < items_.size(); ++i) {
+    hashes[i] = HashPackageName(items_[i].packageName);
+    buckets[BucketOf(hashes[i], num_buckets)].push_back(i);
+  }
+  std::vector<uint32_t> order(num_buckets);
+  for (size_t i = 0; i < num_buckets; ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs) {
+    return buckets[lhs].size() > buckets[rhs].size();
+  });
+  while (true) {
+    seeds_.assign(num_buckets, 0u);
+    slots_.assign(num_slots, 0u);
+    bool placed_all = true;
+    for (uint32_t bucket : order) {
+      if (!PlaceBucket(buckets[bucket], hashes, &seeds_[bucket])) {
+        placed_all = false;
+        break;
+      }
+    }
+    if (placed_all) {
+      return;
+    }
+    // Practically unreachable; a sparser table always has room.
+    num_slots *= 2u;
+  }
+}
+
+bool JniTraceConfigTable::PlaceBucket(const std::vector<uint32_t>& bucket,
+                                      const std::vector<uint64_t>& hashes,
+                                      uint32_t* seed) {
+  std::vector<size_t> taken;
+  for (uint32_t candidate = 0; candidate < kMaxSeed; ++candidate) {
+    taken.clear();
+    for (uint32_t index : bucket) {
+      const size_t slot = SlotOf(hashes[index], candidate, slots_.size());
+      if (slots_[slot] != 0u || std::find(taken.begin(), taken.end(), slot) != taken.end()) {
+        break;
+      }
+      taken.push_back(slot);
+    }
+    if (taken.size() == bucket.size()) {
+      for (size_t i = 0; i < bucket.size(); ++i) {
+        slots_[taken[i]] = bucket[i] + 1u;
+      }
+      *seed = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+int32_t JniTraceConfigTable::Lookup(std::string_view package_name) const {
+  if (items_.empty()) {
+    return -1;
+  }
+  const uint64_t hash = HashPackageName(package_name);
+  const uint32_t seed = seeds_[BucketOf(hash, seeds_.size())];
+  const uint32_t entry = slots_[SlotOf(hash, seed, slots_.size())];
+  // Names that are not in the table land on an arbitrary slot.
+  if (entry == 0u || items_[entry - 1u].packageName != package_name) {
+    return -1;
+  }
+  return static_cast<int32_t>(entry - 1u);
+}
+
+void JniTraceConfig::Preload() {
+  std::unique_ptr<PreloadedConfigs> preloaded(new PreloadedConfigs());
+  preloaded->stamp = StatConfigFile();
+  if (!preloaded->stamp.exists && errno != ENOENT) {
+    // Likely SELinux keeping the zygote out of shell files, the children read it themselves.
+    PLOG(INFO) << "jnitrace config not preloaded";
+    return;
+  }
+  // A missing file preloads an empty table, the children then skip the file too.
+  if (preloaded->stamp.exists && !ReadConfigFile(&preloaded->table)) {
+    return;
+  }
+  for (size_t i = 0; i < preloaded->table.Size(); ++i) {
+    preloaded->configs.push_back(
+        new JniTraceConfig(1u, preloaded->table.Get(i), /* preloaded= */ true));
+  }
+  LOG(INFO) << "jnitrace preloaded " << preloaded->configs.size() << " config entries";
+  gPreloadedConfigs = preloaded.release();
+}
+
+void JniTraceConfig::LoadForPackage(const std::string& package_name) {
+  const PreloadedConfigs* preloaded = gPreloadedConfigs;
+  if (preloaded != nullptr) {
+    // Forked from the zygote: one lookup and no file access. A package added to the file later
+    // needs a zygote restart; edits of listed packages reach the app through the watcher, which
+    // starts from the file as the zygote saw it.
+    const int32_t index = preloaded->table.Lookup(package_name);
+    if (index < 0) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(gPublishLock);
+      const JniTraceConfig* previous = gJniTraceConfig.load(std::memory_order_relaxed);
+      // Preloaded configs are version 1, they can only be the first one.
+      if (previous == nullptr) {
+        Install(preloaded->configs[index], previous);
+      } else {
+        Install(new JniTraceConfig(previous->version + 1u, preloaded->table.Get(index)),
+                previous);
+      }
+    }
+    StartWatcherThread(package_name, preloaded->stamp);
+    return;
+  }
+  const ConfigFileStamp stamp = StatConfigFile();
+  if (!stamp.exists) {
+    return;
+  }
+  JniTraceConfigTable table;
+  if (!ReadConfigFile(&table)) {
+    return;
+  }
+  const PackageItem* item = table.Find(package_name);
+  if (item == nullptr) {
+    return;
+  }
+  Publish(*item);
+  StartWatcherThread(package_name, stamp);
+}
+
+bool JniTraceConfig::ParseOptions(std::string_view spec,
+                                  PackageItem* item,
+                                  std::string* error_msg) {
+  *item = PackageItem();
+  item->isJNIMethodPrint = true;
+  item->isRegisterNativePrint = true;
+  size_t begin = 0;
+  while (begin < spec.size()) {
+    size_t end = spec.find(',', begin);
+    if (end == std::string_view::npos) {
+      end = spec.size();
+    }
+    const std::string_view option = spec.substr(begin, end - begin);
+    begin = end + 1;
+    if (option.empty()) {
+      continue;
+    }
+    const size_t equals = option.find('=');
+    const std::string_view key = option.substr(0, equals);
+    const std::string_view value =
+        equals != std::string_view::npos ? option.substr(equals + 1) : std::string_view();
+    bool ok;
+    if (key == "package") {
+      item->packageName = value;
+      ok = true;
+    } else if (key == "filter") {
+      item->jniFuncName = value;
+      ok = true;
+    } else if (key == "module") {
+      item->jniModuleName = value;
+      ok = true;
+    } else if (key == "methods") {
+      ok = ParseOptionBool(value, &item->isJNIMethodPrint);
+    } else if (key == "register") {
+      ok = ParseOptionBool(value, &item->isRegisterNativePrint);
+    } else if (key == "first") {
+      ok = ParseOptionInt(value, &item->sampleFirst);
+    } else if (key == "sample") {
+      ok = ParseOptionInt(value, &item->sampleEvery);
+    } else if (key == "rate") {
+      ok = ParseOptionInt(value, &item->maxEventsPerSecond);
+    } else if (key == "sink") {
+      item->traceSink = value;
+      ok = true;
+    } else if (key == "drain") {
+      ok = ParseOptionBool(value, &item->drainToFile);
+    } else if (key == "flight") {
+      ok = ParseOptionInt(value, &item->flightRecorderMB);
+    } else if (key == "trigger") {
+      if (!JniTraceTriggers::Validate(value, error_msg)) {
+        *error_msg = "-Xjnitrace: " + *error_msg;
+        return false;
+      }
+      item->triggers = value;
+      ok = true;
+    } else if (key == "window") {
+      ok = ParseOptionInt(value, &item->triggerWindowMs);
+    } else if (key == "pretrigger") {
+      ok = ParseOptionInt(value, &item->preTriggerKB);
+    } else if (key == "overhead") {
+      ok = ParseOptionInt(value, &item->maxOverheadPercent);
+    } else {
+      *error_msg = "-Xjnitrace: unknown key '" + std::string(key) + "'";
+      return false;
+    }
+    if (!ok) {
+      *error_msg = "-Xjnitrace: invalid value '" + std::string(value) + "' for " + std::string(key);
+      return false;
+    }
+  }
+  return true;
+}
+
+void JniTraceConfig::SetLaunchOptions(const PackageItem& item) {
+  delete gLaunchOptions;
+  gLaunchOptions = new PackageItem(item);
+}
+
+void JniTraceConfig::PublishLaunchOptions() {
+  std::unique_ptr<const PackageItem> item(gLaunchOptions);
+  gLaunchOptions = nullptr;
+  if (item != nullptr) {
+    Publish(*item);
+  }
+}
+
+void JniTraceConfig::StartWatcher(const std::string& package_name) {
+  StartWatcherThread(package_name, StatConfigFile());
+}
+
+const JniTraceConfig* JniTraceConfig::Default() {
+  static const JniTraceConfig* const config = new JniTraceConfig(0u, PackageItem());
+  return config;
+}
+
+JniTraceConfigReader* JniTraceConfig::RegisterReader() {
+  pthread_once(&gReaderKeyOnce, CreateReaderKey);
+  JniTraceConfigReader* reader = nullptr;
+  for (JniTraceConfigReader* it = gReaders.load(std::memory_order_acquire);
+       it != nullptr;
+       it = it->next) {
+    bool expected = false;
+    if (!it->in_use.load(std::memory_order_relaxed) &&
+        it->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+      reader = it;
+      break;
+    }
+  }
+  if (reader == nullptr) {
+    reader = new JniTraceConfigReader();
+    reader->in_use.store(true, std::memory_order_relaxed);
+    JniTraceConfigReader* head = gReaders.load(std::memory_order_relaxed);
+    do {
+      reader->next = head;
+    } while (!gReaders.compare_exchange_weak(head,
+                                             reader,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+  }
+  pthread_setspecific(gReaderKey, reader);
+  gJniTraceConfigReader = reader;
+  return reader;
+}
+
+}  // namespace art
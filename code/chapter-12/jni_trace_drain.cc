@@ -0,0 +1,586 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <bitset>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "art_method-inl.h"
+#include "base/logging.h"
+#include "base/mutex.h"
+#include "base/time_utils.h"
+#include "class_linker.h"
+#include "gc/heap.h"
+#include "gc/space/space.h"
+#include "jni_trace.h"
+#include "linear_alloc.h"
+#include "mirror/class_loader.h"
+#include "runtime.h"
+#include "scoped_thread_state_change-inl.h"
+#include "thread.h"
+
+namespace art {
+
+// Asynchronous drain of the per-thread rings into a binary trace file.
+//
+// The file starts with a DrainFileHeader and is followed by blocks, each a DrainBlockHeader and
+// its zlib compressed entries. Several processes of a package append to the same file; every
+// block carries its pid and is written with one write(), so blocks never interleave. Entries
+// start with a kind byte, integers are LEB128 varints:
+//   kEntryRecord    tid, zigzag(timestamp - previous timestamp of the block, the first one
+//                   relative to the block's base), event, func, method, payload size, payload
+//   kEntryFunction  index, name                        names of the record func indices
+//   kEntryMethod    method, pretty name                names of the record methods, see below
+//   kEntryStack     id, frame count, pcs               stacks of the kStackId fields
+//   kEntryModule    begin, end, load bias, name, build id
+//                                                      modules of the pcs, for symbolization
+//   kEntryDropped   tid, count                         events lost to a full ring
+// Strings are a varint length and the bytes. Definitions appear once per process, before or
+// after their first use, so a reader resolves them once it has read all blocks of a pid. The
+// payloads are the JniTracePayloadWriter fields, unchanged.
+//
+// Methods are the exception: an unloaded class loader frees its methods and the addresses get
+// reused, so a method is defined again after every unload and a kEntryMethod names the records
+// of its address since the previous one. Records made before an unload but drained after it
+// stay unnamed, their method may be gone.
+
+namespace {
+
+static constexpr char kDrainFileMagic[8] = {'J', 'N', 'I', 'T', 'R', 'B', 'I', 'N'};
+static constexpr uint32_t kDrainFileVersion = 1u;
+static constexpr uint32_t kDrainBlockMagic = 0x4b4c4254u;  // "TBLK"
+
+struct DrainFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t block_header_size;
+};
+
+struct DrainBlockHeader {
+  uint32_t magic;
+  uint32_t pid;
+  uint32_t raw_size;
+  uint32_t compressed_size;
+  uint64_t base_timestamp_ns;
+};
+
+enum DrainEntry : uint8_t {
+  kEntryRecord = 1,
+  kEntryFunction,
+  kEntryMethod,
+  kEntryStack,
+  kEntryModule,
+  kEntryDropped,
+};
+
+// A block is compressed and written once it holds this much, or once it is this old.
+static constexpr size_t kDrainBlockBytes = 256 * KB;
+static constexpr uint64_t kDrainMaxBlockAgeNs = 1000000000u;
+// Passes run this often, and early when a ring is nearly full.
+static constexpr std::chrono::milliseconds kDrainInterval(100);
+
+// Function name indices, see JniTrace::GetFunctionName.
+static constexpr size_t kDrainMaxFunctions = 1024;
+
+std::mutex gDrainLock;
+std::condition_variable gDrainCondition;
+std::atomic<bool> gDrainWakePending{false};
+
+// States of the live threads, and of exited ones the drain thread has yet to empty. Never
+// destroyed, threads may still exit while the process does.
+std::vector<JniTraceThreadState*>& DrainStates() {
+  static auto* states = new std::vector<JniTraceThreadState*>();
+  return *states;
+}
+
+uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+// Advances `reader` past the data of a field tagged `tag`.
+void SkipField(JniTraceField tag, JniTracePayloadReader* reader) {
+  uint16_t length;
+  switch (tag) {
+    case JniTraceField::kBoolean:
+    case JniTraceField::kByte:
+      reader->GetValue<uint8_t>();
+      break;
+    case JniTraceField::kChar:
+    case JniTraceField::kShort:
+      reader->GetValue<uint16_t>();
+      break;
+    case JniTraceField::kInt:
+    case JniTraceField::kFloat:
+    case JniTraceField::kStackId:
+      reader->GetValue<uint32_t>();
+      break;
+    case JniTraceField::kLong:
+    case JniTraceField::kDouble:
+    case JniTraceField::kPointer:
+      reader->GetValue<uint64_t>();
+      break;
+    case JniTraceField::kString:
+      reader->GetString(&length);
+      break;
+    case JniTraceField::kObject:
+    case JniTraceField::kJavaString:
+      reader->GetString(&length);
+      reader->GetValue<uint32_t>();
+      break;
+    case JniTraceField::kArray:
+      reader->GetString(&length);
+      reader->GetValue<int32_t>();
+      reader->GetString(&length);
+      reader->GetValue<uint32_t>();
+      break;
+    case JniTraceField::kBacktrace:
+      for (uint16_t count = reader->GetValue<uint16_t>(); count != 0u; --count) {
+        reader->GetValue<uint64_t>();
+      }
+      break;
+    case JniTraceField::kNull:
+    case JniTraceField::kResult:
+      break;
+  }
+}
+
+class LiveLoaderVisitor : public ClassLoaderVisitor {
+ public:
+  explicit LiveLoaderVisitor(const void* method) : method_(method) {}
+
+  void Visit(ObjPtr<mirror::ClassLoader> class_loader)
+      REQUIRES_SHARED(Locks::classlinker_classes_lock_, Locks::mutator_lock_) override {
+    LinearAlloc* allocator = class_loader->GetAllocator();
+    if (allocator != nullptr && allocator->Contains(const_cast<void*>(method_))) {
+      live_ = true;
+    }
+  }
+
+  bool IsLive() const {
+    return live_;
+  }
+
+ private:
+  const void* const method_;
+  bool live_ = false;
+};
+
+// Whether `method` is in an image, the runtime LinearAlloc or the LinearAlloc of a class loader
+// still registered. The lock keeps those loaders from being deleted until it is released.
+bool IsLiveMethod(uint64_t method)
+    REQUIRES_SHARED(Locks::classlinker_classes_lock_, Locks::mutator_lock_) {
+  Runtime* runtime = Runtime::Current();
+  void* address = reinterpret_cast<void*>(method);
+  if (runtime->GetLinearAlloc()->Contains(address)) {
+    return true;
+  }
+  gc::space::ContinuousSpace* space = runtime->GetHeap()->FindContinuousSpaceFromAddress(
+      reinterpret_cast<const mirror::Object*>(address));
+  if (space != nullptr && space->IsImageSpace()) {
+    return true;
+  }
+  LiveLoaderVisitor visitor(address);
+  runtime->GetClassLinker()->VisitClassLoaders(&visitor);
+  return visitor.IsLive();
+}
+
+// Encodes the drained records into blocks and appends them to the trace file. Used by the
+// drain thread only.
+class TraceFileWriter {
+ public:
+  TraceFileWriter() : pid_(getpid()) {}
+
+  ~TraceFileWriter() {
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  bool Open(const std::string& package_name) {
+    const std::string dir = std::string(kJniTraceOutputDir) + "/" + package_name;
+    if (mkdir(dir.c_str(), 0771) != 0 && errno != EEXIST) {
+      PLOG(WARNING) << "jnitrace could not create " << dir;
+      return false;
+    }
+    path_ = dir + "/trace.bin";
+    fd_ = open(path_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (fd_ < 0 && errno == ENOENT && CreateWithHeader()) {
+      fd_ = open(path_.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    if (fd_ < 0) {
+      PLOG(WARNING) << "jnitrace could not open " << path_;
+      return false;
+    }
+    return true;
+  }
+
+  const std::string& Path() const {
+    return path_;
+  }
+
+  // Called before the records of a pass are added.
+  void BeginPass() {
+    pass_epoch_ = JniTrace::UnloadEpoch();
+    if (pass_epoch_ != named_epoch_) {
+      // Addresses named before may belong to other methods now.
+      methods_.clear();
+      named_epoch_ = pass_epoch_;
+    }
+  }
+
+  void AddRecord(const JniTraceRecord& record) {
+    StartEntry();
+    DefineFunction(record.func);
+    DefineStacks(record);
+    if (record.method != 0u &&
+        record.unload_epoch == pass_epoch_ &&
+        methods_.insert(record.method).second) {
+      unnamed_methods_.push_back(record.method);
+    }
+    raw_.push_back(kEntryRecord);
+    PutVarint(record.tid);
+    PutVarint(ZigZag(static_cast<int64_t>(record.timestamp_ns - previous_timestamp_ns_)));
+    previous_timestamp_ns_ = record.timestamp_ns;
+    PutVarint(record.event);
+    PutVarint(record.func);
+    PutVarint(record.method);
+    PutVarint(record.payload_size);
+    raw_.append(reinterpret_cast<const char*>(&record + 1), record.payload_size);
+  }
+
+  void AddDropped(pid_t tid, uint64_t count) {
+    StartEntry();
+    raw_.push_back(kEntryDropped);
+    PutVarint(static_cast<uint32_t>(tid));
+    PutVarint(count);
+  }
+
+  // Names the methods first seen since the last call. Takes the mutator lock, only briefly and
+  // only when there is something new. The records are up to a pass old, so every method is
+  // checked to be still allocated before it is read.
+  void NameMethods(Thread* self) {
+    if (unnamed_methods_.empty()) {
+      return;
+    }
+    ScopedObjectAccess soa(self);
+    ReaderMutexLock mu(self, *Locks::classlinker_classes_lock_);
+    // A loader unloaded during the pass may have freed the methods or handed out their memory.
+    // The next pass forgets methods_ and names them again.
+    if (JniTrace::UnloadEpoch() == pass_epoch_) {
+      for (uint64_t method : unnamed_methods_) {
+        if (IsLiveMethod(method)) {
+          raw_.push_back(kEntryMethod);
+          PutVarint(method);
+          PutString(reinterpret_cast<ArtMethod*>(method)->PrettyMethod());
+        }
+      }
+    }
+    unnamed_methods_.clear();
+  }
+
+  // Writes the current block if it is large or old enough.
+  void MaybeWriteBlock() {
+    if (raw_.size() >= kDrainBlockBytes ||
+        (!raw_.empty() && NanoTime() - base_timestamp_ns_ >= kDrainMaxBlockAgeNs)) {
+      WriteBlock();
+    }
+  }
+
+ private:
+  void StartEntry() {
+    if (raw_.empty()) {
+      base_timestamp_ns_ = NanoTime();
+      previous_timestamp_ns_ = base_timestamp_ns_;
+    }
+  }
+
+  void PutVarint(uint64_t value) {
+    while (value >= 0x80u) {
+      raw_.push_back(static_cast<char>(value | 0x80u));
+      value >>= 7;
+    }
+    raw_.push_back(static_cast<char>(value));
+  }
+
+  void PutString(std::string_view text) {
+    PutVarint(text.size());
+    raw_.append(text.data(), text.size());
+  }
+
+  void DefineFunction(uint16_t index) {
+    const size_t slot = index % kDrainMaxFunctions;
+    if (functions_.test(slot)) {
+      return;
+    }
+    functions_.set(slot);
+    raw_.push_back(kEntryFunction);
+    PutVarint(index);
+    PutString(JniTrace::GetFunctionName(index));
+  }
+
+  void DefineStacks(const JniTraceRecord& record) {
+    JniTracePayloadReader reader(record);
+    while (reader.HasNext()) {
+      const JniTraceField tag = reader.NextTag();
+      if (tag == JniTraceField::kStackId) {
+        DefineStack(reader.GetValue<uint32_t>());
+      } else if (tag == JniTraceField::kBacktrace) {
+        for (uint16_t count = reader.GetValue<uint16_t>(); count != 0u; --count) {
+          DefineModule(static_cast<uintptr_t>(reader.GetValue<uint64_t>()));
+        }
+      } else {
+        SkipField(tag, &reader);
+      }
+    }
+  }
+
+  void DefineStack(uint32_t id) {
+    if (!stacks_.insert(id).second) {
+      return;
+    }
+    size_t count;
+    const uintptr_t* pcs = JniTraceStackTable::GetFrames(id, &count);
+    for (size_t i = 0; i < count; ++i) {
+      DefineModule(pcs[i]);
+    }
+    raw_.push_back(kEntryStack);
+    PutVarint(id);
+    PutVarint(count);
+    for (size_t i = 0; i < count; ++i) {
+      PutVarint(pcs[i]);
+    }
+  }
+
+  void DefineModule(uintptr_t pc) {
+    const JniTraceModule* module = JniTraceModuleIndex::Find(pc);
+    if (module == nullptr || !modules_.insert(module).second) {
+      return;
+    }
+    raw_.push_back(kEntryModule);
+    PutVarint(module->begin);
+    PutVarint(module->end);
+    PutVarint(module->load_bias);
+    PutString(module->name);
+    PutString(std::string_view(reinterpret_cast<const char*>(module->build_id),
+                               module->build_id_size));
+  }
+
+  void WriteBlock() {
+    uLongf compressed_size = compressBound(raw_.size());
+    block_.resize(sizeof(DrainBlockHeader) + compressed_size);
+    const int rc = compress2(reinterpret_cast<Bytef*>(&block_[sizeof(DrainBlockHeader)]),
+                             &compressed_size,
+                             reinterpret_cast<const Bytef*>(raw_.data()),
+                             raw_.size(),
+                             Z_BEST_SPEED);
+    if (rc != Z_OK) {
+      LOG(WARNING) << "jnitrace could not compress a block: " << rc;
+    } else if (fd_ >= 0) {
+      DrainBlockHeader header;
+      header.magic = kDrainBlockMagic;
+      header.pid = static_cast<uint32_t>(pid_);
+      header.raw_size = static_cast<uint32_t>(raw_.size());
+      header.compressed_size = static_cast<uint32_t>(compressed_size);
+      header.base_timestamp_ns = base_timestamp_ns_;
+      memcpy(&block_[0], &header, sizeof(header));
+      WriteFully(block_.data(), sizeof(header) + compressed_size);
+    }
+    raw_.clear();
+  }
+
+  // Several processes of the package may create the file at once. The header goes to a file of
+  // this process first, which is then linked into place: whoever finds the file, finds it with
+  // its header. Returns true if the file exists afterwards.
+  bool CreateWithHeader() {
+    const std::string temp_path = path_ + "." + std::to_string(pid_) + ".tmp";
+    fd_ = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+      PLOG(WARNING) << "jnitrace could not create " << temp_path;
+      return false;
+    }
+    DrainFileHeader header = {};
+    memcpy(header.magic, kDrainFileMagic, sizeof(kDrainFileMagic));
+    header.version = kDrainFileVersion;
+    header.block_header_size = sizeof(DrainBlockHeader);
+    bool created = WriteFully(&header, sizeof(header));
+    close(fd_);
+    fd_ = -1;
+    // Losing the race to another process is fine, its file has a header too.
+    if (created && link(temp_path.c_str(), path_.c_str()) != 0 && errno != EEXIST) {
+      PLOG(WARNING) << "jnitrace could not link " << temp_path << " to " << path_;
+      created = false;
+    }
+    unlink(temp_path.c_str());
+    return created;
+  }
+
+  bool WriteFully(const void* data, size_t size) {
+    const char* pos = reinterpret_cast<const char*>(data);
+    while (size != 0u) {
+      const ssize_t written = TEMP_FAILURE_RETRY(write(fd_, pos, size));
+      if (written <= 0) {
+        PLOG(WARNING) << "jnitrace could not write " << path_;
+        return false;
+      }
+      pos += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  const pid_t pid_;
+  int fd_ = -1;
+  std::string path_;
+  // Entries of the current block, uncompressed.
+  std::string raw_;
+  std::string block_;
+  uint64_t base_timestamp_ns_ = 0u;
+  uint64_t previous_timestamp_ns_ = 0u;
+  // What the file already defines.
+  std::bitset<kDrainMaxFunctions> functions_;
+  std::unordered_set<uint64_t> methods_;
+  // Unload epochs of the running pass and of the names in methods_.
+  uint32_t pass_epoch_ = 0u;
+  uint32_t named_epoch_ = 0u;
+  std::unordered_set<uint32_t> stacks_;
+  std::unordered_set<const JniTraceModule*> modules_;
+  std::vector<uint64_t> unnamed_methods_;
+};
+
+// One pass over all rings. Exited threads are deleted once a pass has drained them after they
+// exited; their records are then all in the writer.
+void DrainPass(TraceFileWriter* writer, Thread* self) {
+  std::vector<std::pair<JniTraceThreadState*, bool>> states;
+  {
+    std::lock_guard<std::mutex> lock(gDrainLock);
+    for (JniTraceThreadState* state : DrainStates()) {
+      states.emplace_back(state, state->exited);
+    }
+  }
+  std::vector<JniTraceThreadState*> retired;
+  writer->BeginPass();
+  for (const auto& [state, exited] : states) {
+    // Flight recorder rings stay in their file, and history before a trigger in its ring.
+    if (!state->buffer.Overwrites() &&
+        (!state->holding.load(std::memory_order_acquire) || JniTrace::IsCapturing())) {
+      std::lock_guard<std::mutex> lock(state->drain_lock);
+      state->buffer.Drain([&](const JniTraceRecord& record) { writer->AddRecord(record); });
+      const uint64_t dropped = state->buffer.TakeDropped();
+      if (dropped != 0u) {
+        writer->AddDropped(state->tid, dropped);
+      }
+    }
+    writer->MaybeWriteBlock();
+    if (exited) {
+      retired.push_back(state);
+    }
+  }
+  writer->NameMethods(self);
+  if (!retired.empty()) {
+    std::lock_guard<std::mutex> lock(gDrainLock);
+    std::vector<JniTraceThreadState*>& live = DrainStates();
+    for (JniTraceThreadState* state : retired) {
+      live.erase(std::find(live.begin(), live.end(), state));
+    }
+  }
+  for (JniTraceThreadState* state : retired) {
+    delete state;
+  }
+  writer->MaybeWriteBlock();
+}
+
+void* DrainThread(void* arg) {
+  std::unique_ptr<std::string> package_name(reinterpret_cast<std::string*>(arg));
+  Runtime* runtime = Runtime::Current();
+  // Naming methods needs the mutator lock.
+  CHECK(runtime->AttachCurrentThread("JniTraceDrain",
+                                     /* as_daemon= */ true,
+                                     runtime->GetSystemThreadGroup(),
+                                     /* create_peer= */ !runtime->IsAotCompiler()));
+  Thread* self = Thread::Current();
+  TraceFileWriter writer;
+  if (writer.Open(*package_name)) {
+    LOG(INFO) << "jnitrace draining records to " << writer.Path();
+  }
+  // Without a file the records are still drained, and dropped, so that rings never fill up
+  // and exited threads are freed.
+  {
+    std::lock_guard<std::mutex> lock(gDrainLock);
+    gJniTraceDrainActive.store(true, std::memory_order_relaxed);
+  }
+  while (true) {
+    {
+      // Wake() does not take the lock, a wakeup that races with going to sleep waits for the
+      // next periodic pass.
+      std::unique_lock<std::mutex> lock(gDrainLock);
+      gDrainCondition.wait_for(lock, kDrainInterval, [] {
+        return gDrainWakePending.load(std::memory_order_relaxed);
+      });
+    }
+    gDrainWakePending.store(false, std::memory_order_relaxed);
+    DrainPass(&writer, self);
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+std::atomic<bool> gJniTraceDrainActive{false};
+
+void JniTraceDrain::Start(const std::string& package_name) {
+  Runtime* runtime = Runtime::Current();
+  if (runtime == nullptr || runtime->IsZygote()) {
+    return;
+  }
+  static std::atomic<bool> started{false};
+  if (started.exchange(true)) {
+    return;
+  }
+  std::string* arg =
+      new std::string(package_name.empty() ? std::to_string(getpid()) : package_name);
+  pthread_t thread;
+  const int rc = pthread_create(&thread, nullptr, DrainThread, arg);
+  if (rc != 0) {
+    errno = rc;
+    PLOG(WARNING) << "Could not start the jnitrace drain thread";
+    delete arg;
+    return;
+  }
+  pthread_detach(thread);
+}
+
+void JniTraceDrain::Wake() {
+  if (!gDrainWakePending.exchange(true, std::memory_order_relaxed)) {
+    gDrainCondition.notify_one();
+  }
+}
+
+void JniTraceDrain::Register(JniTraceThreadState* state) {
+  std::lock_guard<std::mutex> lock(gDrainLock);
+  DrainStates().push_back(state);
+}
+
+bool JniTraceDrain::Retire(JniTraceThreadState* state) {
+  std::lock_guard<std::mutex> lock(gDrainLock);
+  if (gJniTraceDrainActive.load(std::memory_order_relaxed)) {
+    state->exited = true;
+    return true;
+  }
+  std::vector<JniTraceThreadState*>& states = DrainStates();
+  states.erase(std::find(states.begin(), states.end(), state));
+  return false;
+}
+
+}  // namespace art
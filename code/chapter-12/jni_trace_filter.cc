@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "base/logging.h"
+#include "jni_trace.h"
+
+namespace art {
+
+// Compiled include/exclude pattern sets.
+//
+// Every pattern contributes one literal key, its longest run without wildcards, to a single
+// Aho-Corasick automaton. Matching walks the text through the automaton once, which finds every
+// pattern whose key occurs; only those candidates are then checked against their full glob. The
+// cost of a match therefore depends on the text and the number of candidates, not on the number
+// of configured patterns.
+
+namespace {
+
+bool IsWildcard(char c) {
+  return c == '*' || c == '?';
+}
+
+// Anchored glob match of `text` against `pattern`.
+bool GlobMatches(std::string_view pattern, std::string_view text) {
+  size_t p = 0;
+  size_t t = 0;
+  size_t star = std::string_view::npos;
+  size_t star_text = 0;
+  while (t < text.size()) {
+    if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+      ++p;
+      ++t;
+    } else if (p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      star_text = t;
+    } else if (star != std::string_view::npos) {
+      p = star + 1;
+      t = ++star_text;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+// Longest literal run of a glob.
+std::string_view LongestLiteral(std::string_view pattern) {
+  std::string_view best;
+  size_t begin = 0;
+  for (size_t i = 0; i <= pattern.size(); ++i) {
+    if (i == pattern.size() || IsWildcard(pattern[i])) {
+      if (i - begin > best.size()) {
+        best = pattern.substr(begin, i - begin);
+      }
+      begin = i + 1;
+    }
+  }
+  return best;
+}
+
+}  // namespace
+
+JniTraceFilter::JniTraceFilter(std::string_view spec) {
+  // Split the spec into patterns.
+  size_t begin = 0;
+  while (begin < spec.size()) {
+    size_t end = spec.find_first_of(",| \t\n", begin);
+    if (end == std::string_view::npos) {
+      end = spec.size();
+    }
+    std::string_view text = spec.substr(begin, end - begin);
+    begin = end + 1;
+    Pattern pattern;
+    pattern.exclude = !text.empty() && text[0] == '!';
+    if (pattern.exclude) {
+      text.remove_prefix(1);
+    }
+    if (text.empty()) {
+      continue;
+    }
+    pattern.literal = std::none_of(text.begin(), text.end(), IsWildcard);
+    pattern.glob = text;
+    has_includes_ |= !pattern.exclude;
+    patterns_.push_back(std::move(pattern));
+  }
+
+  // Character classes: one per byte used in a key, the rest share class 0.
+  std::fill(std::begin(char_class_), std::end(char_class_), 0u);
+  num_classes_ = 1u;
+  for (const Pattern& pattern : patterns_) {
+    for (char c : LongestLiteral(pattern.glob)) {
+      uint8_t& char_class = char_class_[static_cast<uint8_t>(c)];
+      if (char_class == 0u) {
+        char_class = static_cast<uint8_t>(num_classes_++);
+      }
+    }
+  }
+
+  // Trie of the keys. Patterns without a key are candidates for every text.
+  std::vector<std::vector<int32_t>> go(1, std::vector<int32_t>(num_classes_, -1));
+  outputs_.assign(1, {});
+  for (uint32_t i = 0; i < patterns_.size(); ++i) {
+    std::string_view key = LongestLiteral(patterns_[i].glob);
+    if (key.empty()) {
+      always_candidates_.push_back(i);
+      continue;
+    }
+    int32_t node = 0;
+    for (char c : key) {
+      const uint8_t char_class = char_class_[static_cast<uint8_t>(c)];
+      if (go[node][char_class] < 0) {
+        go[node][char_class] = static_cast<int32_t>(go.size());
+        go.emplace_back(num_classes_, -1);
+        outputs_.emplace_back();
+      }
+      node = go[node][char_class];
+    }
+    outputs_[node].push_back(i);
+  }
+
+  // Breadth-first failure links, folded into a complete transition table.
+  std::vector<int32_t> fail(go.size(), 0);
+  std::deque<int32_t> queue;
+  for (size_t c = 0; c < num_classes_; ++c) {
+    if (go[0][c] < 0) {
+      go[0][c] = 0;
+    } else {
+      fail[go[0][c]] = 0;
+      queue.push_back(go[0][c]);
+    }
+  }
+  while (!queue.empty()) {
+    const int32_t node = queue.front();
+    queue.pop_front();
+    // Keys ending at the failure node also end here.
+    const std::vector<uint32_t>& inherited = outputs_[fail[node]];
+    outputs_[node].insert(outputs_[node].end(), inherited.begin(), inherited.end());
+    for (size_t c = 0; c < num_classes_; ++c) {
+      const int32_t next = go[node][c];
+      if (next < 0) {
+        go[node][c] = go[fail[node]][c];
+      } else {
+        fail[next] = go[fail[node]][c];
+        queue.push_back(next);
+      }
+    }
+  }
+  transitions_.resize(go.size() * num_classes_);
+  for (size_t node = 0; node < go.size(); ++node) {
+    std::copy(go[node].begin(), go[node].end(), transitions_.begin() + node * num_classes_);
+  }
+}
+
+bool JniTraceFilter::Matches(std::string_view text) const {
+  if (patterns_.empty()) {
+    return true;
+  }
+  // Patterns are few per text; a small bitmap of the candidates avoids re-checking a pattern
+  // whose key occurs several times.
+  std::vector<bool> checked(patterns_.size(), false);
+  bool included = !has_includes_;
+  auto check = [&](uint32_t index) {
+    if (checked[index]) {
+      return false;
+    }
+    checked[index] = true;
+    const Pattern& pattern = patterns_[index];
+    // A literal pattern matches as a substring, as the single-name filter always did, and its
+    // key occurring is the match.
+    if (!pattern.literal && !GlobMatches(pattern.glob, text)) {
+      return false;
+    }
+    if (pattern.exclude) {
+      return true;
+    }
+    included = true;
+    return false;
+  };
+  for (uint32_t index : always_candidates_) {
+    if (check(index)) {
+      return false;
+    }
+  }
+  size_t node = 0;
+  for (char c : text) {
+    node = transitions_[node * num_classes_ + char_class_[static_cast<uint8_t>(c)]];
+    for (uint32_t index : outputs_[node]) {
+      if (check(index)) {
+        return false;
+      }
+    }
+  }
+  return included;
+}
+
+static constexpr const char* kTriggerKindNames[JniTraceTriggers::kKinds] = {
+    "NewStringUTF",
+    "GetStringUTFChars",
+    "GetMethodID",
+    "RegisterNative",
+};
+
+JniTraceTriggers::JniTraceTriggers(std::string_view spec) {
+  std::string specs[kKinds];
+  std::string error_msg;
+  if (!Split(spec, specs, &error_msg)) {
+    // Validated when the config was read; a bad rule disables the triggers rather than making
+    // every call a match.
+    LOG(WARNING) << "jnitrace: ignoring triggers, " << error_msg;
+    return;
+  }
+  for (size_t kind = 0; kind < kKinds; ++kind) {
+    if (!specs[kind].empty()) {
+      filters_[kind].reset(new JniTraceFilter(specs[kind]));
+      empty_ = false;
+    }
+  }
+}
+
+bool JniTraceTriggers::Split(std::string_view spec, std::string* specs, std::string* error_msg) {
+  size_t begin = 0;
+  while (begin < spec.size()) {
+    size_t end = spec.find_first_of(",| \t\n", begin);
+    if (end == std::string_view::npos) {
+      end = spec.size();
+    }
+    const std::string_view rule = spec.substr(begin, end - begin);
+    begin = end + 1;
+    if (rule.empty()) {
+      continue;
+    }
+    const size_t colon = rule.find(':');
+    const std::string_view name = rule.substr(0, colon);
+    size_t kind = 0;
+    while (kind < kKinds && name != kTriggerKindNames[kind]) {
+      ++kind;
+    }
+    if (colon == std::string_view::npos || colon + 1 == rule.size() || kind == kKinds) {
+      *error_msg = "bad trigger '" + std::string(rule) + "'";
+      return false;
+    }
+    if (!specs[kind].empty()) {
+      specs[kind] += '|';
+    }
+    specs[kind] += rule.substr(colon + 1);
+  }
+  return true;
+}
+
+bool JniTraceTriggers::Validate(std::string_view spec, std::string* error_msg) {
+  std::string specs[kKinds];
+  return Split(spec, specs, error_msg);
+}
+
+const char* JniTraceTriggers::KindName(Kind kind) {
+  return kind < kKinds ? kTriggerKindNames[kind] : "?";
+}
+
+}  // namespace art
@@ -0,0 +1,346 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/bit_utils.h"
+#include "base/globals.h"
+#include "base/logging.h"
+#include "base/time_utils.h"
+#include "base/utils.h"
+#include "jni_trace.h"
+#include "runtime.h"
+#include "sigchain.h"
+
+namespace art {
+
+// Flight recorder file layout, all offsets from the start of the file:
+//   FlightHeader       kFlightHeaderSize bytes
+//   function names     kFlightFunctions entries of kFlightFunctionNameSize bytes, by index,
+//                      empty if never used; the names of the record func indices
+//   stacks             kFlightStacks FlightStack entries, the first stacks_used of them taken;
+//                      an entry with count 0 was being written
+//   slots              slot_count rings, each a JniTraceFlightSlot and kJniTraceFlightRingBytes
+//                      of records
+// A slot's records lie between its tail and head, modulo the ring size, and are JniTraceRecords
+// as in memory; each carries the tid of the thread that wrote it. Timestamps are NanoTime(), the
+// header pairs its start with the wall clock. Methods appear as ArtMethod pointers, named by
+// the kGetMethodID records that produced them; kRegisterNative records name theirs. Frame pcs
+// are absolute, the tombstone or /proc/<pid>/maps of the process places them.
+//
+// Nothing here reads the rings. Producers publish with release stores into the shared pages,
+// which outlive the process, so the only work left for a dying process is to say why it died.
+
+namespace {
+
+static constexpr char kFlightMagic[8] = {'J', 'N', 'I', 'F', 'L', 'I', 'T', 'E'};
+static constexpr uint32_t kFlightVersion = 1u;
+static constexpr size_t kFlightHeaderSize = 4 * KB;
+// As many as JniTrace interns.
+static constexpr size_t kFlightFunctions = 1024;
+static constexpr size_t kFlightFunctionNameSize = 64;
+static constexpr size_t kFlightStacks = 2048;
+
+struct FlightHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t pid;
+  uint32_t slot_count;
+  uint32_t slot_size;       // Slot header and ring.
+  uint32_t ring_size;
+  uint64_t functions_offset;
+  uint64_t stacks_offset;
+  uint64_t slots_offset;
+  uint64_t start_realtime_ns;
+  uint64_t start_monotonic_ns;
+  std::atomic<uint32_t> stacks_used;
+  // The last fatal signal seen. A process still running afterwards handled it itself.
+  std::atomic<uint32_t> signal_count;
+  std::atomic<int32_t> last_signal;
+  std::atomic<int32_t> last_signal_tid;
+  std::atomic<uint64_t> last_signal_address;
+  std::atomic<uint64_t> last_signal_ns;
+  // SIGQUIT dumps, the ones for ANRs among them.
+  std::atomic<uint64_t> checkpoints;
+  std::atomic<uint64_t> last_checkpoint_ns;
+};
+
+static_assert(sizeof(FlightHeader) <= kFlightHeaderSize, "FlightHeader too large");
+
+struct FlightStack {
+  uint32_t id;
+  std::atomic<uint32_t> count;  // Written last.
+  uint64_t pcs[kJniTraceMaxFrames];
+};
+
+// Signals that usually end the process. SIGKILL cannot be caught, and needs nothing anyway.
+static constexpr int kFatalSignals[] = {SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV, SIGSYS};
+
+// The mapping, set once the file is complete. Never unmapped.
+std::atomic<uint8_t*> gFlightBase{nullptr};
+size_t gFlightSize = 0u;
+std::string* gFlightPath = nullptr;
+
+FlightHeader* Header(uint8_t* base) {
+  return reinterpret_cast<FlightHeader*>(base);
+}
+
+JniTraceFlightSlot* Slot(uint8_t* base, size_t index) {
+  const FlightHeader* header = Header(base);
+  return reinterpret_cast<JniTraceFlightSlot*>(base + header->slots_offset +
+                                               index * header->slot_size);
+}
+
+uint64_t RealTimeNs() {
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return static_cast<uint64_t>(now.tv_sec) * UINT64_C(1000000000) + now.tv_nsec;
+}
+
+// Deletes the flight.<pid>.bin files in `dir` but the `keep` most recently modified.
+void PruneFlightFiles(const std::string& dir, size_t keep) {
+  DIR* entries = opendir(dir.c_str());
+  if (entries == nullptr) {
+    return;
+  }
+  std::vector<std::pair<int64_t, std::string>> files;  // Modification time, path.
+  while (dirent* entry = readdir(entries)) {
+    const size_t length = strlen(entry->d_name);
+    if (strncmp(entry->d_name, "flight.", 7) != 0 || length < 11 ||
+        strcmp(entry->d_name + length - 4, ".bin") != 0) {
+      continue;
+    }
+    std::string path = dir + "/" + entry->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      files.emplace_back(static_cast<int64_t>(st.st_mtime), std::move(path));
+    }
+  }
+  closedir(entries);
+  if (files.size() <= keep) {
+    return;
+  }
+  // Newest first. A process still running keeps its mapping, deleting only takes the name.
+  std::sort(files.begin(), files.end(), std::greater<std::pair<int64_t, std::string>>());
+  for (size_t i = keep; i < files.size(); ++i) {
+    if (unlink(files[i].second.c_str()) != 0) {
+      PLOG(WARNING) << "jnitrace could not delete " << files[i].second;
+    }
+  }
+}
+
+// Special sigchain handler, so it runs before the app's handlers and, for SIGSEGV, after the
+// runtime's fault manager has passed on the implicit checks. Async-signal-safe: atomic stores
+// and one msync.
+bool OnFatalSignal(int signal, siginfo_t* info, void* /* context */) {
+  uint8_t* base = gFlightBase.load(std::memory_order_acquire);
+  if (base != nullptr) {
+    FlightHeader* header = Header(base);
+    header->last_signal.store(signal, std::memory_order_relaxed);
+    header->last_signal_tid.store(static_cast<int32_t>(GetTid()), std::memory_order_relaxed);
+    header->last_signal_address.store(reinterpret_cast<uintptr_t>(info->si_addr),
+                                      std::memory_order_relaxed);
+    header->last_signal_ns.store(NanoTime(), std::memory_order_relaxed);
+    header->signal_count.fetch_add(1u, std::memory_order_release);
+    // The pages survive the process either way; this only gets them to storage sooner, in case
+    // the device goes down with it.
+    msync(base, gFlightSize, MS_ASYNC);
+  }
+  // Let the next handler, in the end debuggerd, see the signal.
+  return false;
+}
+
+void HookFatalSignals() {
+  for (int signal : kFatalSignals) {
+    SigchainAction action;
+    action.sc_sigaction = OnFatalSignal;
+    sigemptyset(&action.sc_mask);
+    action.sc_flags = 0u;
+    AddSpecialSignalHandlerFn(signal, &action);
+  }
+}
+
+}  // namespace
+
+void JniTraceFlightRecorder::Start(const std::string& package_name, size_t megabytes) {
+  Runtime* runtime = Runtime::Current();
+  if (runtime == nullptr || runtime->IsZygote()) {
+    return;
+  }
+  static std::atomic<bool> started{false};
+  if (started.exchange(true)) {
+    return;
+  }
+  const std::string dir = std::string(kJniTraceOutputDir) + "/" +
+                          (package_name.empty() ? std::to_string(getpid()) : package_name);
+  if (mkdir(dir.c_str(), 0771) != 0 && errno != EEXIST) {
+    PLOG(WARNING) << "jnitrace could not create " << dir;
+    return;
+  }
+  const std::string path = dir + "/flight." + std::to_string(getpid()) + ".bin";
+  // Room for the new file. A pid reused from an old file is truncated below anyway.
+  PruneFlightFiles(dir, kJniTraceFlightMaxFiles - 1);
+  const size_t slot_size = kJniTraceFlightSlotHeaderSize + kJniTraceFlightRingBytes;
+  const size_t slot_count = std::max<size_t>(megabytes * MB / kJniTraceFlightRingBytes, 1u);
+  const size_t functions_offset = kFlightHeaderSize;
+  const size_t stacks_offset = functions_offset + kFlightFunctions * kFlightFunctionNameSize;
+  const size_t slots_offset = RoundUp(stacks_offset + kFlightStacks * sizeof(FlightStack),
+                                      kPageSize);
+  const size_t size = slots_offset + slot_count * slot_size;
+  const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    PLOG(WARNING) << "jnitrace could not create " << path;
+    return;
+  }
+  // Allocated up front: a write fault on a hole of a full disk would be a SIGBUS in whatever
+  // thread is tracing.
+  const int rc = posix_fallocate(fd, 0, size);
+  if (rc != 0) {
+    errno = rc;
+    PLOG(WARNING) << "jnitrace could not allocate " << size << " bytes for " << path;
+    close(fd);
+    unlink(path.c_str());
+    return;
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  // The mapping keeps the file.
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    PLOG(WARNING) << "jnitrace could not map " << path;
+    unlink(path.c_str());
+    return;
+  }
+  uint8_t* base = reinterpret_cast<uint8_t*>(mapping);
+  FlightHeader* header = Header(base);
+  memcpy(header->magic, kFlightMagic, sizeof(kFlightMagic));
+  header->version = kFlightVersion;
+  header->header_size = kFlightHeaderSize;
+  header->pid = static_cast<uint32_t>(getpid());
+  header->slot_count = static_cast<uint32_t>(slot_count);
+  header->slot_size = static_cast<uint32_t>(slot_size);
+  header->ring_size = static_cast<uint32_t>(kJniTraceFlightRingBytes);
+  header->functions_offset = functions_offset;
+  header->stacks_offset = stacks_offset;
+  header->slots_offset = slots_offset;
+  header->start_realtime_ns = RealTimeNs();
+  header->start_monotonic_ns = NanoTime();
+  gFlightSize = size;
+  gFlightPath = new std::string(path);
+  gFlightBase.store(base, std::memory_order_release);
+  // Names interned before the recorder started.
+  for (size_t index = 0; index < kFlightFunctions; ++index) {
+    const char* name = JniTrace::GetFunctionName(static_cast<uint16_t>(index));
+    if (strcmp(name, "?") != 0) {
+      NameFunction(static_cast<uint16_t>(index), name);
+    }
+  }
+  HookFatalSignals();
+  LOG(INFO) << "jnitrace flight recorder of " << slot_count << " threads at " << path;
+}
+
+bool JniTraceFlightRecorder::IsActive() {
+  return gFlightBase.load(std::memory_order_relaxed) != nullptr;
+}
+
+JniTraceFlightSlot* JniTraceFlightRecorder::AcquireSlot(pid_t tid) {
+  uint8_t* base = gFlightBase.load(std::memory_order_acquire);
+  if (base == nullptr) {
+    return nullptr;
+  }
+  const size_t slot_count = Header(base)->slot_count;
+  // Threads come and go rarely; a scan per new thread is cheap. A lost race scans again.
+  for (size_t attempt = 0; attempt < slot_count; ++attempt) {
+    JniTraceFlightSlot* oldest = nullptr;
+    uint64_t oldest_ns = UINT64_MAX;
+    for (size_t index = 0; index < slot_count; ++index) {
+      JniTraceFlightSlot* slot = Slot(base, index);
+      const uint64_t released_ns = slot->released_ns.load(std::memory_order_relaxed);
+      if (slot->tid.load(std::memory_order_relaxed) == 0u && released_ns < oldest_ns) {
+        oldest = slot;
+        oldest_ns = released_ns;
+      }
+    }
+    if (oldest == nullptr) {
+      return nullptr;
+    }
+    uint32_t expected = 0u;
+    if (oldest->tid.compare_exchange_strong(expected,
+                                            static_cast<uint32_t>(tid),
+                                            std::memory_order_acquire)) {
+      // The ring carries on after the previous owner's records.
+      return oldest;
+    }
+  }
+  return nullptr;
+}
+
+void JniTraceFlightRecorder::ReleaseSlot(JniTraceFlightSlot* slot) {
+  slot->released_ns.store(NanoTime(), std::memory_order_relaxed);
+  slot->tid.store(0u, std::memory_order_release);
+}
+
+void JniTraceFlightRecorder::NameFunction(uint16_t index, const char* name) {
+  uint8_t* base = gFlightBase.load(std::memory_order_acquire);
+  if (base == nullptr || index >= kFlightFunctions) {
+    return;
+  }
+  char* entry = reinterpret_cast<char*>(base + Header(base)->functions_offset +
+                                        index * kFlightFunctionNameSize);
+  snprintf(entry, kFlightFunctionNameSize, "%s", name);
+}
+
+void JniTraceFlightRecorder::RecordStack(uint32_t id, const uintptr_t* pcs, size_t count) {
+  uint8_t* base = gFlightBase.load(std::memory_order_acquire);
+  if (base == nullptr || count == 0u) {
+    return;
+  }
+  FlightHeader* header = Header(base);
+  const uint32_t index = header->stacks_used.fetch_add(1u, std::memory_order_relaxed);
+  if (index >= kFlightStacks) {
+    // Full; records of this stack keep an id the file does not resolve.
+    header->stacks_used.store(kFlightStacks, std::memory_order_relaxed);
+    return;
+  }
+  FlightStack* stack = reinterpret_cast<FlightStack*>(base + header->stacks_offset) + index;
+  count = std::min(count, kJniTraceMaxFrames);
+  stack->id = id;
+  for (size_t i = 0; i < count; ++i) {
+    stack->pcs[i] = pcs[i];
+  }
+  stack->count.store(static_cast<uint32_t>(count), std::memory_order_release);
+}
+
+void JniTraceFlightRecorder::Checkpoint(std::ostream& os) {
+  uint8_t* base = gFlightBase.load(std::memory_order_acquire);
+  if (base == nullptr) {
+    return;
+  }
+  FlightHeader* header = Header(base);
+  header->last_checkpoint_ns.store(NanoTime(), std::memory_order_relaxed);
+  const uint64_t checkpoint = header->checkpoints.fetch_add(1u, std::memory_order_release) + 1u;
+  msync(base, gFlightSize, MS_ASYNC);
+  size_t live = 0u;
+  for (size_t index = 0; index < header->slot_count; ++index) {
+    if (Slot(base, index)->tid.load(std::memory_order_relaxed) != 0u) {
+      ++live;
+    }
+  }
+  os << "jnitrace flight recorder " << *gFlightPath << ": checkpoint " << checkpoint << ", "
+     << live << " of " << header->slot_count << " rings in use\n";
+}
+
+}  // namespace art
@@ -0,0 +1,673 @@
+#include <stdarg.h>
+
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "base/time_utils.h"
+#include "jni.h"
+#include "jni/check_jni.h"
+#include "jni/jni_env_ext.h"
+#include "jni/jni_internal.h"
+#include "jni_trace.h"
+#include "reflection.h"
+#include "scoped_thread_state_change-inl.h"
+
+namespace art {
+
+// Instrumented JNIEnv function table.
+//
+// The table wraps every entry of the stock interface and is only installed, through the same
+// JNIEnvExt table override JVMTI uses, in the package that has jnitrace enabled. Every other
+// process keeps running the stock table with no added branches. Inside the traced process a
+// wrapper costs one TLS load until the thread enters a watched native method.
+
+// All JNINativeInterface entries in declaration order, grouped by how they are traced:
+//   GENERIC  records the raw arguments and the return value,
+//   VARARGS  is forwarded to the traced V variant,
+//   METHOD   decodes the arguments of the jmethodID through its shorty,
+//   SPECIAL  has a hand-written wrapper below.
+#define JNI_TRACE_FUNCTION_LIST(GENERIC, VARARGS, METHOD, SPECIAL) \
+  GENERIC(GetVersion) \
+  GENERIC(DefineClass) \
+  GENERIC(FindClass) \
+  GENERIC(FromReflectedMethod) \
+  GENERIC(FromReflectedField) \
+  GENERIC(ToReflectedMethod) \
+  GENERIC(GetSuperclass) \
+  GENERIC(IsAssignableFrom) \
+  GENERIC(ToReflectedField) \
+  GENERIC(Throw) \
+  GENERIC(ThrowNew) \
+  GENERIC(ExceptionOccurred) \
+  GENERIC(ExceptionDescribe) \
+  GENERIC(ExceptionClear) \
+  GENERIC(FatalError) \
+  GENERIC(PushLocalFrame) \
+  GENERIC(PopLocalFrame) \
+  GENERIC(NewGlobalRef) \
+  GENERIC(DeleteGlobalRef) \
+  GENERIC(DeleteLocalRef) \
+  GENERIC(IsSameObject) \
+  GENERIC(NewLocalRef) \
+  GENERIC(EnsureLocalCapacity) \
+  GENERIC(AllocObject) \
+  VARARGS(NewObject) \
+  METHOD(NewObjectV) \
+  METHOD(NewObjectA) \
+  GENERIC(GetObjectClass) \
+  GENERIC(IsInstanceOf) \
+  SPECIAL(GetMethodID) \
+  VARARGS(CallObjectMethod) \
+  METHOD(CallObjectMethodV) \
+  METHOD(CallObjectMethodA) \
+  VARARGS(CallBooleanMethod) \
+  METHOD(CallBooleanMethodV) \
+  METHOD(CallBooleanMethodA) \
+  VARARGS(CallByteMethod) \
+  METHOD(CallByteMethodV) \
+  METHOD(CallByteMethodA) \
+  VARARGS(CallCharMethod) \
+  METHOD(CallCharMethodV) \
+  METHOD(CallCharMethodA) \
+  VARARGS(CallShortMethod) \
+  METHOD(CallShortMethodV) \
+  METHOD(CallShortMethodA) \
+  VARARGS(CallIntMethod) \
+  METHOD(CallIntMethodV) \
+  METHOD(CallIntMethodA) \
+  VARARGS(CallLongMethod) \
+  METHOD(CallLongMethodV) \
+  METHOD(CallLongMethodA) \
+  VARARGS(CallFloatMethod) \
+  METHOD(CallFloatMethodV) \
+  METHOD(CallFloatMethodA) \
+  VARARGS(CallDoubleMethod) \
+  METHOD(CallDoubleMethodV) \
+  METHOD(CallDoubleMethodA) \
+  VARARGS(CallVoidMethod) \
+  METHOD(CallVoidMethodV) \
+  METHOD(CallVoidMethodA) \
+  VARARGS(CallNonvirtualObjectMethod) \
+  METHOD(CallNonvirtualObjectMethodV) \
+  METHOD(CallNonvirtualObjectMethodA) \
+  VARARGS(CallNonvirtualBooleanMethod) \
+  METHOD(CallNonvirtualBooleanMethodV) \
+  METHOD(CallNonvirtualBooleanMethodA) \
+  VARARGS(CallNonvirtualByteMethod) \
+  METHOD(CallNonvirtualByteMethodV) \
+  METHOD(CallNonvirtualByteMethodA) \
+  VARARGS(CallNonvirtualCharMethod) \
+  METHOD(CallNonvirtualCharMethodV) \
+  METHOD(CallNonvirtualCharMethodA) \
+  VARARGS(CallNonvirtualShortMethod) \
+  METHOD(CallNonvirtualShortMethodV) \
+  METHOD(CallNonvirtualShortMethodA) \
+  VARARGS(CallNonvirtualIntMethod) \
+  METHOD(CallNonvirtualIntMethodV) \
+  METHOD(CallNonvirtualIntMethodA) \
+  VARARGS(CallNonvirtualLongMethod) \
+  METHOD(CallNonvirtualLongMethodV) \
+  METHOD(CallNonvirtualLongMethodA) \
+  VARARGS(CallNonvirtualFloatMethod) \
+  METHOD(CallNonvirtualFloatMethodV) \
+  METHOD(CallNonvirtualFloatMethodA) \
+  VARARGS(CallNonvirtualDoubleMethod) \
+  METHOD(CallNonvirtualDoubleMethodV) \
+  METHOD(CallNonvirtualDoubleMethodA) \
+  VARARGS(CallNonvirtualVoidMethod) \
+  METHOD(CallNonvirtualVoidMethodV) \
+  METHOD(CallNonvirtualVoidMethodA) \
+  GENERIC(GetFieldID) \
+  GENERIC(GetObjectField) \
+  GENERIC(GetBooleanField) \
+  GENERIC(GetByteField) \
+  GENERIC(GetCharField) \
+  GENERIC(GetShortField) \
+  GENERIC(GetIntField) \
+  GENERIC(GetLongField) \
+  GENERIC(GetFloatField) \
+  GENERIC(GetDoubleField) \
+  GENERIC(SetObjectField) \
+  GENERIC(SetBooleanField) \
+  GENERIC(SetByteField) \
+  GENERIC(SetCharField) \
+  GENERIC(SetShortField) \
+  GENERIC(SetIntField) \
+  GENERIC(SetLongField) \
+  GENERIC(SetFloatField) \
+  GENERIC(SetDoubleField) \
+  SPECIAL(GetStaticMethodID) \
+  VARARGS(CallStaticObjectMethod) \
+  METHOD(CallStaticObjectMethodV) \
+  METHOD(CallStaticObjectMethodA) \
+  VARARGS(CallStaticBooleanMethod) \
+  METHOD(CallStaticBooleanMethodV) \
+  METHOD(CallStaticBooleanMethodA) \
+  VARARGS(CallStaticByteMethod) \
+  METHOD(CallStaticByteMethodV) \
+  METHOD(CallStaticByteMethodA) \
+  VARARGS(CallStaticCharMethod) \
+  METHOD(CallStaticCharMethodV) \
+  METHOD(CallStaticCharMethodA) \
+  VARARGS(CallStaticShortMethod) \
+  METHOD(CallStaticShortMethodV) \
+  METHOD(CallStaticShortMethodA) \
+  VARARGS(CallStaticIntMethod) \
+  METHOD(CallStaticIntMethodV) \
+  METHOD(CallStaticIntMethodA) \
+  VARARGS(CallStaticLongMethod) \
+  METHOD(CallStaticLongMethodV) \
+  METHOD(CallStaticLongMethodA) \
+  VARARGS(CallStaticFloatMethod) \
+  METHOD(CallStaticFloatMethodV) \
+  METHOD(CallStaticFloatMethodA) \
+  VARARGS(CallStaticDoubleMethod) \
+  METHOD(CallStaticDoubleMethodV) \
+  METHOD(CallStaticDoubleMethodA) \
+  VARARGS(CallStaticVoidMethod) \
+  METHOD(CallStaticVoidMethodV) \
+  METHOD(CallStaticVoidMethodA) \
+  GENERIC(GetStaticFieldID) \
+  GENERIC(GetStaticObjectField) \
+  GENERIC(GetStaticBooleanField) \
+  GENERIC(GetStaticByteField) \
+  GENERIC(GetStaticCharField) \
+  GENERIC(GetStaticShortField) \
+  GENERIC(GetStaticIntField) \
+  GENERIC(GetStaticLongField) \
+  GENERIC(GetStaticFloatField) \
+  GENERIC(GetStaticDoubleField) \
+  GENERIC(SetStaticObjectField) \
+  GENERIC(SetStaticBooleanField) \
+  GENERIC(SetStaticByteField) \
+  GENERIC(SetStaticCharField) \
+  GENERIC(SetStaticShortField) \
+  GENERIC(SetStaticIntField) \
+  GENERIC(SetStaticLongField) \
+  GENERIC(SetStaticFloatField) \
+  GENERIC(SetStaticDoubleField) \
+  GENERIC(NewString) \
+  GENERIC(GetStringLength) \
+  GENERIC(GetStringChars) \
+  GENERIC(ReleaseStringChars) \
+  SPECIAL(NewStringUTF) \
+  GENERIC(GetStringUTFLength) \
+  SPECIAL(GetStringUTFChars) \
+  GENERIC(ReleaseStringUTFChars) \
+  GENERIC(GetArrayLength) \
+  GENERIC(NewObjectArray) \
+  GENERIC(GetObjectArrayElement) \
+  GENERIC(SetObjectArrayElement) \
+  GENERIC(NewBooleanArray) \
+  GENERIC(NewByteArray) \
+  GENERIC(NewCharArray) \
+  GENERIC(NewShortArray) \
+  GENERIC(NewIntArray) \
+  GENERIC(NewLongArray) \
+  GENERIC(NewFloatArray) \
+  GENERIC(NewDoubleArray) \
+  GENERIC(GetBooleanArrayElements) \
+  GENERIC(GetByteArrayElements) \
+  GENERIC(GetCharArrayElements) \
+  GENERIC(GetShortArrayElements) \
+  GENERIC(GetIntArrayElements) \
+  GENERIC(GetLongArrayElements) \
+  GENERIC(GetFloatArrayElements) \
+  GENERIC(GetDoubleArrayElements) \
+  GENERIC(ReleaseBooleanArrayElements) \
+  GENERIC(ReleaseByteArrayElements) \
+  GENERIC(ReleaseCharArrayElements) \
+  GENERIC(ReleaseShortArrayElements) \
+  GENERIC(ReleaseIntArrayElements) \
+  GENERIC(ReleaseLongArrayElements) \
+  GENERIC(ReleaseFloatArrayElements) \
+  GENERIC(ReleaseDoubleArrayElements) \
+  GENERIC(GetBooleanArrayRegion) \
+  GENERIC(GetByteArrayRegion) \
+  GENERIC(GetCharArrayRegion) \
+  GENERIC(GetShortArrayRegion) \
+  GENERIC(GetIntArrayRegion) \
+  GENERIC(GetLongArrayRegion) \
+  GENERIC(GetFloatArrayRegion) \
+  GENERIC(GetDoubleArrayRegion) \
+  GENERIC(SetBooleanArrayRegion) \
+  GENERIC(SetByteArrayRegion) \
+  GENERIC(SetCharArrayRegion) \
+  GENERIC(SetShortArrayRegion) \
+  GENERIC(SetIntArrayRegion) \
+  GENERIC(SetLongArrayRegion) \
+  GENERIC(SetFloatArrayRegion) \
+  GENERIC(SetDoubleArrayRegion) \
+  GENERIC(RegisterNatives) \
+  GENERIC(UnregisterNatives) \
+  GENERIC(MonitorEnter) \
+  GENERIC(MonitorExit) \
+  GENERIC(GetJavaVM) \
+  GENERIC(GetStringRegion) \
+  GENERIC(GetStringUTFRegion) \
+  GENERIC(GetPrimitiveArrayCritical) \
+  GENERIC(ReleasePrimitiveArrayCritical) \
+  GENERIC(GetStringCritical) \
+  GENERIC(ReleaseStringCritical) \
+  GENERIC(NewWeakGlobalRef) \
+  GENERIC(DeleteWeakGlobalRef) \
+  GENERIC(ExceptionCheck) \
+  GENERIC(NewDirectByteBuffer) \
+  GENERIC(GetDirectBufferAddress) \
+  GENERIC(GetDirectBufferCapacity) \
+  GENERIC(GetObjectRefType)
+
+namespace {
+
+#define JNI_TRACE_DECLARE_NAME(name) constexpr char kTraceName##name[] = #name;
+JNI_TRACE_FUNCTION_LIST(JNI_TRACE_DECLARE_NAME,
+                        JNI_TRACE_DECLARE_NAME,
+                        JNI_TRACE_DECLARE_NAME,
+                        JNI_TRACE_DECLARE_NAME)
+#undef JNI_TRACE_DECLARE_NAME
+
+// The stock tables the wrappers forward to. Like JNIEnvExt::GetFunctionTable without the
+// override, an env with CheckJNI enabled keeps going through the checked table.
+const JNINativeInterface* gBaseInterface = nullptr;
+const JNINativeInterface* gCheckJniInterface = nullptr;
+
+inline const JNINativeInterface* BaseInterface(JNIEnv* env) {
+  return UNLIKELY(static_cast<JNIEnvExt*>(env)->IsCheckJniEnabled())
+      ? gCheckJniInterface
+      : gBaseInterface;
+}
+
+template <auto kMember>
+using MemberFunction =
+    std::remove_reference_t<decltype(std::declval<JNINativeInterface&>().*kMember)>;
+
+// Raw argument capture for GENERIC entries. No reference is decoded, so this is safe in JNI
+// critical sections too.
+inline void RecordArg(JniTracePayloadWriter* writer, const char* value) {
+  if (value == nullptr) {
+    writer->PutTag(JniTraceField::kNull);
+  } else {
+    writer->PutCString(JniTraceField::kString, value);
+  }
+}
+template <typename T>
+inline void RecordArg(JniTracePayloadWriter* writer, T* value) {
+  writer->PutValue(JniTraceField::kPointer, reinterpret_cast<uint64_t>(value));
+}
+inline void RecordArg(JniTracePayloadWriter* writer, jboolean value) {
+  writer->PutValue(JniTraceField::kBoolean, value);
+}
+inline void RecordArg(JniTracePayloadWriter* writer, jbyte value) {
+  writer->PutValue(JniTraceField::kByte, value);
+}
+inline void RecordArg(JniTracePayloadWriter* writer, jchar value) {
+  writer->PutValue(JniTraceField::kChar, value);
+}
+inline void RecordArg(JniTracePayloadWriter* writer, jshort value) {
+  writer->PutValue(JniTraceField::kShort, value);
+}
+inline void RecordArg(JniTracePayloadWriter* writer, jint value) {
+  writer->PutValue(JniTraceField::kInt, value);
+}
+inline void RecordArg(JniTracePayloadWriter* writer, jlong value) {
+  writer->PutValue(JniTraceField::kLong, value);
+}
+inline void RecordArg(JniTracePayloadWriter* writer, jfloat value) {
+  writer->PutValue(JniTraceField::kFloat, value);
+}
+inline void RecordArg(JniTracePayloadWriter* writer, jdouble value) {
+  writer->PutValue(JniTraceField::kDouble, value);
+}
+inline void RecordArg(JniTracePayloadWriter* writer, jobjectRefType value) {
+  writer->PutValue(JniTraceField::kInt, static_cast<int32_t>(value));
+}
+
+// Release entries get back a string that the stock call frees before the arguments are recorded,
+// so only its address is.
+template <bool kStringsAsPointers, typename T>
+inline void RecordGenericArg(JniTracePayloadWriter* writer, T value) {
+  if constexpr (kStringsAsPointers && std::is_same_v<T, const char*>) {
+    writer->PutValue(JniTraceField::kPointer, reinterpret_cast<uint64_t>(value));
+  } else {
+    RecordArg(writer, value);
+  }
+}
+
+template <bool kStringsAsPointers, typename R, typename... Args>
+void RecordGenericCall(const char* name, const R* result, Args... args) {
+  JniTraceThreadState* state = JniTrace::CurrentThreadState();
+  JniTraceRecord* record = JniTrace::BeginRecord(state, JniTraceEvent::kJniCall, name, 0);
+  if (record == nullptr) {
+    return;
+  }
+  JniTracePayloadWriter writer(record);
+  if (!JniTrace::RecordsArguments(state)) {
+    JniTrace::EndRecord(state, record, writer);
+    return;
+  }
+  (RecordGenericArg<kStringsAsPointers>(&writer, args), ...);
+  if (result != nullptr) {
+    writer.PutTag(JniTraceField::kResult);
+    RecordArg(&writer, *result);
+  }
+  JniTrace::EndRecord(state, record, writer);
+}
+
+template <auto kMember, const char* kName, typename Fn = MemberFunction<kMember>>
+struct TracedFunction;
+
+template <auto kMember, const char* kName, typename R, typename... Args>
+struct TracedFunction<kMember, kName, R (*)(JNIEnv*, Args...)> {
+  static constexpr bool kReleasesString = kName == kTraceNameReleaseStringUTFChars;
+
+  static R Call(JNIEnv* env, Args... args) {
+    if (LIKELY(!JniTrace::IsTracingCurrentThread()) ||
+        !JniTrace::Admit(kName, __builtin_return_address(0))) {
+      return (BaseInterface(env)->*kMember)(env, args...);
+    }
+    if constexpr (std::is_void_v<R>) {
+      (BaseInterface(env)->*kMember)(env, args...);
+      RecordGenericCall<kReleasesString, int>(kName, nullptr, args...);
+    } else {
+      R result = (BaseInterface(env)->*kMember)(env, args...);
+      RecordGenericCall<kReleasesString>(kName, &result, args...);
+      return result;
+    }
+  }
+};
+
+// Records a Call<Type>Method{V,A} or NewObject{V,A}. Object results are recorded with their
+// contents, primitive results are not.
+template <typename R>
+void RecordMethodCall(JNIEnv* env, const char* name, jmethodID mid, va_list args, R* result) {
+  ScopedObjectAccess soa(env);
+  if constexpr (std::is_convertible_v<R, jobject>) {
+    ShowVarArgs(soa, name, mid, args, static_cast<jobject>(*result));
+  } else {
+    ShowVarArgs(soa, name, mid, args);
+  }
+}
+
+template <typename R>
+void RecordMethodCall(JNIEnv* env, const char* name, jmethodID mid, const jvalue* args, R* result) {
+  ScopedObjectAccess soa(env);
+  if constexpr (std::is_convertible_v<R, jobject>) {
+    ShowVarArgs(soa, name, mid, args, static_cast<jobject>(*result));
+  } else {
+    ShowVarArgs(soa, name, mid, args);
+  }
+}
+
+// Runs a Call<Type>Method{V,A} or NewObject{V,A} made while tracing. Every call is timed into
+// the latency histogram of its jmethodID; only the calls the sampler admits are recorded.
+// `call` forwards to the stock table, `record` gets the result, or null for void methods.
+template <typename R, typename CallFn, typename RecordFn>
+ALWAYS_INLINE R TraceMethodCall(const char* name,
+                                const void* call_site,
+                                jmethodID mid,
+                                const CallFn& call,
+                                const RecordFn& record) {
+  const bool admitted = JniTrace::Admit(name, call_site);
+  const uint64_t start = NanoTime();
+  if constexpr (std::is_void_v<R>) {
+    call();
+    JniTrace::RecordLatency(
+        JniTraceLatencyKind::kCall, reinterpret_cast<uintptr_t>(mid), NanoTime() - start);
+    if (admitted) {
+      record(static_cast<int*>(nullptr));
+    }
+  } else {
+    R result = call();
+    JniTrace::RecordLatency(
+        JniTraceLatencyKind::kCall, reinterpret_cast<uintptr_t>(mid), NanoTime() - start);
+    if (admitted) {
+      record(&result);
+    }
+    return result;
+  }
+}
+
+template <auto kMember, const char* kName, typename Fn = MemberFunction<kMember>>
+struct TracedMethodCall;
+
+// Call<Type>MethodV, CallStatic<Type>MethodV, NewObjectV.
+template <auto kMember, const char* kName, typename R, typename A1>
+struct TracedMethodCall<kMember, kName, R (*)(JNIEnv*, A1, jmethodID, va_list)> {
+  static R Call(JNIEnv* env, A1 a1, jmethodID mid, va_list args) {
+    return Invoke(kName, __builtin_return_address(0), env, a1, mid, args);
+  }
+
+  static R Invoke(const char* name, const void* call_site, JNIEnv* env, A1 a1, jmethodID mid,
+                  va_list args) {
+    if (LIKELY(!JniTrace::IsTracingCurrentThread()) || mid == nullptr) {
+      return (BaseInterface(env)->*kMember)(env, a1, mid, args);
+    }
+    // The call consumes `args`, keep a copy for the trace record.
+    va_list trace_args;
+    va_copy(trace_args, args);
+    auto call = [&]() { return (BaseInterface(env)->*kMember)(env, a1, mid, args); };
+    auto record = [&](auto* result) { RecordMethodCall(env, name, mid, trace_args, result); };
+    if constexpr (std::is_void_v<R>) {
+      TraceMethodCall<R>(name, call_site, mid, call, record);
+      va_end(trace_args);
+    } else {
+      R result = TraceMethodCall<R>(name, call_site, mid, call, record);
+      va_end(trace_args);
+      return result;
+    }
+  }
+};
+
+// CallNonvirtual<Type>MethodV.
+template <auto kMember, const char* kName, typename R>
+struct TracedMethodCall<kMember, kName, R (*)(JNIEnv*, jobject, jclass, jmethodID, va_list)> {
+  static R Call(JNIEnv* env, jobject obj, jclass c, jmethodID mid, va_list args) {
+    return Invoke(kName, __builtin_return_address(0), env, obj, c, mid, args);
+  }
+
+  static R Invoke(const char* name, const void* call_site, JNIEnv* env, jobject obj, jclass c,
+                  jmethodID mid, va_list args) {
+    if (LIKELY(!JniTrace::IsTracingCurrentThread()) || mid == nullptr) {
+      return (BaseInterface(env)->*kMember)(env, obj, c, mid, args);
+    }
+    va_list trace_args;
+    va_copy(trace_args, args);
+    auto call = [&]() { return (BaseInterface(env)->*kMember)(env, obj, c, mid, args); };
+    auto record = [&](auto* result) { RecordMethodCall(env, name, mid, trace_args, result); };
+    if constexpr (std::is_void_v<R>) {
+      TraceMethodCall<R>(name, call_site, mid, call, record);
+      va_end(trace_args);
+    } else {
+      R result = TraceMethodCall<R>(name, call_site, mid, call, record);
+      va_end(trace_args);
+      return result;
+    }
+  }
+};
+
+// Call<Type>MethodA, CallStatic<Type>MethodA, NewObjectA.
+template <auto kMember, const char* kName, typename R, typename A1>
+struct TracedMethodCall<kMember, kName, R (*)(JNIEnv*, A1, jmethodID, const jvalue*)> {
+  static R Call(JNIEnv* env, A1 a1, jmethodID mid, const jvalue* args) {
+    if (LIKELY(!JniTrace::IsTracingCurrentThread()) || mid == nullptr) {
+      return (BaseInterface(env)->*kMember)(env, a1, mid, args);
+    }
+    return TraceMethodCall<R>(
+        kName,
+        __builtin_return_address(0),
+        mid,
+        [&]() { return (BaseInterface(env)->*kMember)(env, a1, mid, args); },
+        [&](auto* result) { RecordMethodCall(env, kName, mid, args, result); });
+  }
+};
+
+// CallNonvirtual<Type>MethodA.
+template <auto kMember, const char* kName, typename R>
+struct TracedMethodCall<kMember, kName, R (*)(JNIEnv*, jobject, jclass, jmethodID, const jvalue*)> {
+  static R Call(JNIEnv* env, jobject obj, jclass c, jmethodID mid, const jvalue* args) {
+    if (LIKELY(!JniTrace::IsTracingCurrentThread()) || mid == nullptr) {
+      return (BaseInterface(env)->*kMember)(env, obj, c, mid, args);
+    }
+    return TraceMethodCall<R>(
+        kName,
+        __builtin_return_address(0),
+        mid,
+        [&]() { return (BaseInterface(env)->*kMember)(env, obj, c, mid, args); },
+        [&](auto* result) { RecordMethodCall(env, kName, mid, args, result); });
+  }
+};
+
+// The C varargs entries collect their arguments and go through the traced V variant, recording
+// under their own name.
+template <typename VCall, const char* kName, typename Fn>
+struct TracedVarArgs;
+
+template <typename VCall, const char* kName, typename R, typename A1>
+struct TracedVarArgs<VCall, kName, R (*)(JNIEnv*, A1, jmethodID, ...)> {
+  static R Call(JNIEnv* env, A1 a1, jmethodID mid, ...) {
+    va_list args;
+    va_start(args, mid);
+    if constexpr (std::is_void_v<R>) {
+      VCall::Invoke(kName, __builtin_return_address(0), env, a1, mid, args);
+      va_end(args);
+    } else {
+      R result = VCall::Invoke(kName, __builtin_return_address(0), env, a1, mid, args);
+      va_end(args);
+      return result;
+    }
+  }
+};
+
+template <typename VCall, const char* kName, typename R>
+struct TracedVarArgs<VCall, kName, R (*)(JNIEnv*, jobject, jclass, jmethodID, ...)> {
+  static R Call(JNIEnv* env, jobject obj, jclass c, jmethodID mid, ...) {
+    va_list args;
+    va_start(args, mid);
+    if constexpr (std::is_void_v<R>) {
+      VCall::Invoke(kName, __builtin_return_address(0), env, obj, c, mid, args);
+      va_end(args);
+    } else {
+      R result = VCall::Invoke(kName, __builtin_return_address(0), env, obj, c, mid, args);
+      va_end(args);
+      return result;
+    }
+  }
+};
+
+// Trigger rules look at every watched call, they run before Admit so that neither the sampler
+// nor the rate limiter can hide the call that should open a capture window.
+static void CheckTrigger(JniTraceTriggers::Kind kind, const char* text) {
+  if (UNLIKELY(JniTrace::HasTrigger(kind)) && text != nullptr) {
+    JniTrace::CheckTrigger(kind, text);
+  }
+}
+
+static void CheckMethodTrigger(const char* name, const char* sig) {
+  if (UNLIKELY(JniTrace::HasTrigger(JniTraceTriggers::kGetMethodID)) &&
+      name != nullptr &&
+      sig != nullptr) {
+    JniTrace::CheckTrigger(JniTraceTriggers::kGetMethodID, std::string(name) + sig);
+  }
+}
+
+// Hand-written wrappers keeping the detailed records of the original hooks.
+struct TracedSpecial {
+  static jmethodID GetMethodID(JNIEnv* env, jclass c, const char* name, const char* sig) {
+    jmethodID result = BaseInterface(env)->GetMethodID(env, c, name, sig);
+    if (LIKELY(!JniTrace::IsTracingCurrentThread())) {
+      return result;
+    }
+    CheckMethodTrigger(name, sig);
+    if (result != nullptr && JniTrace::Admit(kTraceNameGetMethodID, __builtin_return_address(0))) {
+      ScopedObjectAccess soa(env);
+      ShowVarArgs(soa, kTraceNameGetMethodID, c, name, sig, result);
+    }
+    return result;
+  }
+
+  static jmethodID GetStaticMethodID(JNIEnv* env, jclass c, const char* name, const char* sig) {
+    jmethodID result = BaseInterface(env)->GetStaticMethodID(env, c, name, sig);
+    if (LIKELY(!JniTrace::IsTracingCurrentThread())) {
+      return result;
+    }
+    CheckMethodTrigger(name, sig);
+    if (result != nullptr && JniTrace::Admit(kTraceNameGetStaticMethodID, __builtin_return_address(0))) {
+      ScopedObjectAccess soa(env);
+      ShowVarArgs(soa, kTraceNameGetStaticMethodID, c, name, sig, result);
+    }
+    return result;
+  }
+
+  static jstring NewStringUTF(JNIEnv* env, const char* utf) {
+    jstring result = BaseInterface(env)->NewStringUTF(env, utf);
+    if (LIKELY(!JniTrace::IsTracingCurrentThread())) {
+      return result;
+    }
+    CheckTrigger(JniTraceTriggers::kNewStringUTF, utf);
+    if (utf != nullptr && JniTrace::Admit(kTraceNameNewStringUTF, __builtin_return_address(0))) {
+      ScopedObjectAccess soa(env);
+      ShowVarArgs(soa, kTraceNameNewStringUTF, utf);
+    }
+    return result;
+  }
+
+  static const char* GetStringUTFChars(JNIEnv* env, jstring java_string, jboolean* is_copy) {
+    const char* result = BaseInterface(env)->GetStringUTFChars(env, java_string, is_copy);
+    if (LIKELY(!JniTrace::IsTracingCurrentThread())) {
+      return result;
+    }
+    CheckTrigger(JniTraceTriggers::kGetStringUTFChars, result);
+    if (result != nullptr &&
+        JniTrace::Admit(kTraceNameGetStringUTFChars, __builtin_return_address(0))) {
+      ScopedObjectAccess soa(env);
+      ShowVarArgs(soa, kTraceNameGetStringUTFChars, is_copy, result);
+    }
+    return result;
+  }
+};
+
+#define JNI_TRACE_GENERIC(name) \
+    TracedFunction<&JNINativeInterface::name, kTraceName##name>::Call,
+#define JNI_TRACE_VARARGS(name) \
+    TracedVarArgs<TracedMethodCall<&JNINativeInterface::name##V, kTraceName##name##V>, \
+                  kTraceName##name, \
+                  MemberFunction<&JNINativeInterface::name>>::Call,
+#define JNI_TRACE_METHOD(name) \
+    TracedMethodCall<&JNINativeInterface::name, kTraceName##name>::Call,
+#define JNI_TRACE_SPECIAL(name) \
+    TracedSpecial::name,
+
+const JNINativeInterface gJniTraceNativeInterface = {
+  nullptr,  // reserved0.
+  nullptr,  // reserved1.
+  nullptr,  // reserved2.
+  nullptr,  // reserved3.
+  JNI_TRACE_FUNCTION_LIST(JNI_TRACE_GENERIC,
+                          JNI_TRACE_VARARGS,
+                          JNI_TRACE_METHOD,
+                          JNI_TRACE_SPECIAL)
+};
+
+#undef JNI_TRACE_GENERIC
+#undef JNI_TRACE_VARARGS
+#undef JNI_TRACE_METHOD
+#undef JNI_TRACE_SPECIAL
+
+}  // namespace
+
+void JniTrace::SetNativeInterfaceInstalled(bool installed) {
+  static bool is_installed = false;
+  // Leave the override alone unless we own it, JVMTI agents use the same hook.
+  if (installed == is_installed) {
+    return;
+  }
+  if (gBaseInterface == nullptr) {
+    gBaseInterface = GetJniNativeInterface();
+    gCheckJniInterface = GetCheckJniNativeInterface();
+  }
+  JNIEnvExt::SetTableOverride(installed ? &gJniTraceNativeInterface : nullptr);
+  is_installed = installed;
+}
+
+}  // namespace art
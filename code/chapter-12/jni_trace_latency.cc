@@ -0,0 +1,243 @@
+#include <errno.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "android-base/file.h"
+#include "art_method-inl.h"
+#include "base/bit_utils.h"
+#include "base/mutex.h"
+#include "jni/jni_internal.h"
+#include "jni_trace.h"
+#include "runtime.h"
+#include "thread.h"
+
+namespace art {
+
+// Latency histograms of the watched native methods and of the Java methods they call.
+//
+// Every traced thread owns a JniTraceLatencyTable and is the only writer of its counts, so
+// timing a call costs two clock reads and one relaxed store. The tables are registered here and
+// merged only when a dump is requested; a thread that exits folds its counts into the retired
+// totals first.
+
+namespace {
+
+using LatencyKey = std::tuple<uintptr_t, JniTraceLatencyKind, uint32_t>;
+
+struct MergedHistogram {
+  uint64_t counts[JniTraceHistogram::kBuckets] = {};
+};
+
+using MergedHistograms = std::map<LatencyKey, MergedHistogram>;
+
+std::mutex gLatencyLock;
+
+// Never destroyed, threads may still exit while the process does.
+std::vector<const JniTraceLatencyTable*>& LiveTables() {
+  static auto* tables = new std::vector<const JniTraceLatencyTable*>();
+  return *tables;
+}
+
+MergedHistograms& RetiredHistograms() {
+  static auto* histograms = new MergedHistograms();
+  return *histograms;
+}
+
+void MergeTable(const JniTraceLatencyTable& table, MergedHistograms* into) {
+  for (const JniTraceLatencyTable::Entry& entry : table) {
+    const JniTraceHistogram* histogram = entry.histogram.load(std::memory_order_acquire);
+    if (histogram == nullptr) {
+      continue;
+    }
+    MergedHistogram& merged = (*into)[LatencyKey(entry.id, entry.kind, entry.epoch)];
+    for (size_t i = 0; i < JniTraceHistogram::kBuckets; ++i) {
+      merged.counts[i] += histogram->Count(i);
+    }
+  }
+}
+
+struct LatencyRow {
+  std::string name;
+  uint64_t count;
+  uint64_t total_ns;  // Estimated from the bucket bounds.
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t max;
+};
+
+uint64_t Percentile(const MergedHistogram& histogram, uint64_t count, uint64_t percent) {
+  const uint64_t rank = std::max<uint64_t>(1u, (count * percent + 99u) / 100u);
+  uint64_t seen = 0u;
+  for (size_t i = 0; i < JniTraceHistogram::kBuckets; ++i) {
+    seen += histogram.counts[i];
+    if (seen >= rank) {
+      return JniTraceHistogram::BucketUpperBound(i);
+    }
+  }
+  return JniTraceHistogram::BucketUpperBound(JniTraceHistogram::kBuckets - 1);
+}
+
+// Only methods measured since the last class loader unload are still known to be allocated,
+// older ones are printed as their id.
+std::string LatencyName(const LatencyKey& key, uint32_t epoch) NO_THREAD_SAFETY_ANALYSIS {
+  const auto [id, latency_kind, key_epoch] = key;
+  const char* kind = latency_kind == JniTraceLatencyKind::kNative ? "native " : "call   ";
+  if (key_epoch != epoch) {
+    char unnamed[32];
+    snprintf(unnamed, sizeof(unnamed), "unloaded %p", reinterpret_cast<void*>(id));
+    return kind + std::string(unnamed);
+  }
+  ArtMethod* method = latency_kind == JniTraceLatencyKind::kNative
+      ? reinterpret_cast<ArtMethod*>(id)
+      : jni::DecodeArtMethod(reinterpret_cast<jmethodID>(id));
+  return kind + (method != nullptr ? method->PrettyMethod() : std::string("?"));
+}
+
+// Next to the app data, or with -Xjnitrace and no package in kJniTraceOutputDir/<pid>, as the
+// flight recorder does. Empty if the directory cannot be created.
+std::string LatencyFilePath(const std::string& package_name) {
+  if (!package_name.empty()) {
+    return "/data/data/" + package_name + "/jni_latency.txt";
+  }
+  const std::string dir = std::string(kJniTraceOutputDir) + "/" + std::to_string(getpid());
+  if (mkdir(dir.c_str(), 0771) != 0 && errno != EEXIST) {
+    PLOG(WARNING) << "jnitrace could not create " << dir;
+    return std::string();
+  }
+  return dir + "/jni_latency.txt";
+}
+
+}  // namespace
+
+size_t JniTraceHistogram::BucketIndex(uint64_t ns) {
+  if (ns < kSubBuckets) {
+    return static_cast<size_t>(ns);
+  }
+  const size_t exponent = 63u - CLZ(ns);
+  if (exponent > kMaxExponent) {
+    return kBuckets - 1u;
+  }
+  const size_t sub_bucket = (ns >> (exponent - kSubBucketBits)) & (kSubBuckets - 1u);
+  return (exponent - kSubBucketBits + 1u) * kSubBuckets + sub_bucket;
+}
+
+uint64_t JniTraceHistogram::BucketUpperBound(size_t bucket) {
+  if (bucket < kSubBuckets) {
+    return bucket;
+  }
+  const size_t exponent = bucket / kSubBuckets + kSubBucketBits - 1u;
+  const uint64_t width = UINT64_C(1) << (exponent - kSubBucketBits);
+  return (kSubBuckets + bucket % kSubBuckets) * width + width - 1u;
+}
+
+JniTraceLatencyTable::JniTraceLatencyTable() {
+  std::lock_guard<std::mutex> lock(gLatencyLock);
+  LiveTables().push_back(this);
+}
+
+JniTraceLatencyTable::~JniTraceLatencyTable() {
+  {
+    std::lock_guard<std::mutex> lock(gLatencyLock);
+    MergeTable(*this, &RetiredHistograms());
+    std::vector<const JniTraceLatencyTable*>& tables = LiveTables();
+    tables.erase(std::find(tables.begin(), tables.end(), this));
+  }
+  for (Entry& entry : entries_) {
+    delete entry.histogram.load(std::memory_order_relaxed);
+  }
+}
+
+void JniTraceLatencyTable::Add(JniTraceLatencyKind kind, uintptr_t id, uint64_t ns) {
+  const uint32_t epoch = JniTrace::UnloadEpoch();
+  size_t index = ((id >> 2) * 0x9e3779b9u + static_cast<size_t>(kind)) & (kCapacity - 1u);
+  for (size_t probe = 0; probe < kCapacity; ++probe) {
+    Entry& entry = entries_[index];
+    // Only the owning thread writes, relaxed is enough to read back its own entries.
+    JniTraceHistogram* histogram = entry.histogram.load(std::memory_order_relaxed);
+    if (histogram == nullptr) {
+      entry.id = id;
+      entry.kind = kind;
+      entry.epoch = epoch;
+      histogram = new JniTraceHistogram();
+      histogram->Add(ns);
+      entry.histogram.store(histogram, std::memory_order_release);
+      return;
+    }
+    if (entry.id == id && entry.kind == kind && entry.epoch == epoch) {
+      histogram->Add(ns);
+      return;
+    }
+    index = (index + 1u) & (kCapacity - 1u);
+  }
+  // Table full, the duration is dropped.
+}
+
+void JniTrace::RecordLatency(JniTraceLatencyKind kind, uintptr_t id, uint64_t ns) {
+  CurrentThreadState()->latency.Add(kind, id, ns);
+}
+
+void JniTrace::DumpLatency(std::ostream& os) {
+  // Held by ClassLinker::DumpForSigQuit, so no loader is freed while the rows are named.
+  Locks::classlinker_classes_lock_->AssertSharedHeld(Thread::Current());
+  const uint32_t epoch = UnloadEpoch();
+  MergedHistograms merged;
+  {
+    std::lock_guard<std::mutex> lock(gLatencyLock);
+    merged = RetiredHistograms();
+    for (const JniTraceLatencyTable* table : LiveTables()) {
+      MergeTable(*table, &merged);
+    }
+  }
+  if (merged.empty()) {
+    return;
+  }
+  std::vector<LatencyRow> rows;
+  rows.reserve(merged.size());
+  for (const auto& [key, histogram] : merged) {
+    LatencyRow row = {};
+    for (size_t i = 0; i < JniTraceHistogram::kBuckets; ++i) {
+      row.count += histogram.counts[i];
+      row.total_ns += histogram.counts[i] * JniTraceHistogram::BucketUpperBound(i);
+      if (histogram.counts[i] != 0u) {
+        row.max = JniTraceHistogram::BucketUpperBound(i);
+      }
+    }
+    if (row.count == 0u) {
+      continue;
+    }
+    row.name = LatencyName(key, epoch);
+    row.p50 = Percentile(histogram, row.count, 50u);
+    row.p90 = Percentile(histogram, row.count, 90u);
+    row.p99 = Percentile(histogram, row.count, 99u);
+    rows.push_back(std::move(row));
+  }
+  // Most expensive first.
+  std::sort(rows.begin(), rows.end(), [](const LatencyRow& lhs, const LatencyRow& rhs) {
+    return lhs.total_ns > rhs.total_ns;
+  });
+  std::ostringstream text;
+  text << "JNI latency histograms (ns, bucket upper bounds)\n";
+  text << "count p50 p90 p99 max method\n";
+  for (const LatencyRow& row : rows) {
+    text << row.count << " " << row.p50 << " " << row.p90 << " " << row.p99 << " " << row.max
+         << " " << row.name << "\n";
+  }
+  os << text.str();
+  const std::string path = LatencyFilePath(Runtime::Current()->GetConfigItem()->packageName);
+  if (!path.empty() && !android::base::WriteStringToFile(text.str(), path)) {
+    PLOG(WARNING) << "Could not write " << path;
+  }
+}
+
+}  // namespace art
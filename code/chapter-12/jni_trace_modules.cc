@@ -0,0 +1,203 @@
+#include <elf.h>
+#include <link.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "base/bit_utils.h"
+#include "base/time_utils.h"
+#include "jni_trace.h"
+
+namespace art {
+
+// Address-range index of the loaded modules.
+//
+// Readers binary search an immutable snapshot published through an atomic pointer, so a lookup
+// takes no lock and makes no call into the linker. A lookup that misses checks the linker's
+// load/unload counters and rebuilds the snapshot if they moved; modules that were already
+// indexed are carried over instead of being parsed again. Snapshots and modules are never
+// freed, readers may still be using them, and only a dlopen or dlclose creates new ones.
+//
+// Checking the counters takes the linker lock, and backtraces are full of JIT and anonymous
+// pcs that no module will ever contain. A page that missed is therefore remembered for the
+// snapshot it missed in, for up to kMissLifetimeNs, so that it does not check again; the time
+// bound covers a library later mapped over the same page without any other miss noticing.
+
+namespace {
+
+struct ModuleSnapshot {
+  std::vector<const JniTraceModule*> modules;  // Sorted by begin, non-overlapping.
+  unsigned long long adds = 0u;
+  unsigned long long subs = 0u;
+  uint32_t generation = 0u;  // Rebuilds before this one.
+};
+
+std::atomic<const ModuleSnapshot*> gModuleSnapshot{nullptr};
+// Serializes rebuilds, readers never take it.
+std::mutex gModuleRebuildLock;
+
+// Pages that recently missed, direct mapped. Each slot packs the page, the low bits of the
+// snapshot generation and of the time in units of kMissLifetimeNs, see MissKey.
+static constexpr size_t kMissSlots = 256;  // Power of two.
+static constexpr uint64_t kMissLifetimeNs = UINT64_C(1) << 27;  // About 134 ms.
+std::atomic<uint64_t> gMisses[kMissSlots];
+
+std::atomic<uint64_t>& MissSlot(uintptr_t addr) {
+  return gMisses[(((addr >> 12) * UINT64_C(0x9e3779b97f4a7c15)) >> 56) & (kMissSlots - 1u)];
+}
+
+// User space pcs fit in 48 bits, which leaves 28 bits for the generation and the time.
+uint64_t MissKey(uintptr_t addr, const ModuleSnapshot* snapshot) {
+  const uint64_t page = static_cast<uint64_t>(addr) >> 12;
+  const uint64_t tick = NanoTime() / kMissLifetimeNs;
+  return (page << 28) | ((snapshot->generation & 0xffffu) << 12) | (tick & 0xfffu);
+}
+
+bool HasLoadCounters(size_t size) {
+  return size >= offsetof(dl_phdr_info, dlpi_subs) + sizeof(dl_phdr_info::dlpi_subs);
+}
+
+const JniTraceModule* Lookup(const ModuleSnapshot* snapshot, uintptr_t addr) {
+  auto it = std::upper_bound(snapshot->modules.begin(),
+                             snapshot->modules.end(),
+                             addr,
+                             [](uintptr_t value, const JniTraceModule* module) {
+                               return value < module->begin;
+                             });
+  if (it == snapshot->modules.begin()) {
+    return nullptr;
+  }
+  const JniTraceModule* module = *(it - 1);
+  return addr < module->end ? module : nullptr;
+}
+
+void ReadBuildId(const dl_phdr_info* info, const ElfW(Phdr)& phdr, JniTraceModule* module) {
+  const uint8_t* note = reinterpret_cast<const uint8_t*>(info->dlpi_addr + phdr.p_vaddr);
+  const uint8_t* const end = note + phdr.p_memsz;
+  while (note + sizeof(ElfW(Nhdr)) <= end) {
+    const ElfW(Nhdr)* header = reinterpret_cast<const ElfW(Nhdr)*>(note);
+    const uint8_t* name = note + sizeof(ElfW(Nhdr));
+    const uint8_t* desc = name + RoundUp(header->n_namesz, 4);
+    const uint8_t* next = desc + RoundUp(header->n_descsz, 4);
+    if (next > end) {
+      return;
+    }
+    if (header->n_type == NT_GNU_BUILD_ID &&
+        header->n_namesz == 4 &&
+        memcmp(name, "GNU", 4) == 0) {
+      module->build_id_size = std::min<size_t>(header->n_descsz, sizeof(module->build_id));
+      memcpy(module->build_id, desc, module->build_id_size);
+      return;
+    }
+    note = next;
+  }
+}
+
+struct RebuildState {
+  const ModuleSnapshot* previous;
+  ModuleSnapshot* next;
+};
+
+int RebuildCallback(dl_phdr_info* info, size_t size, void* data) {
+  RebuildState* state = reinterpret_cast<RebuildState*>(data);
+  if (HasLoadCounters(size)) {
+    state->next->adds = info->dlpi_adds;
+    state->next->subs = info->dlpi_subs;
+  }
+  // The module spans all of its PT_LOAD segments, not just the last program header.
+  uintptr_t begin = UINTPTR_MAX;
+  uintptr_t end = 0u;
+  for (size_t i = 0; i < info->dlpi_phnum; ++i) {
+    const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+    if (phdr.p_type == PT_LOAD) {
+      begin = std::min<uintptr_t>(begin, info->dlpi_addr + phdr.p_vaddr);
+      end = std::max<uintptr_t>(end, info->dlpi_addr + phdr.p_vaddr + phdr.p_memsz);
+    }
+  }
+  if (begin >= end) {
+    return 0;
+  }
+  const char* name = info->dlpi_name != nullptr ? info->dlpi_name : "";
+  const JniTraceModule* module =
+      state->previous != nullptr ? Lookup(state->previous, begin) : nullptr;
+  if (module == nullptr ||
+      module->begin != begin ||
+      module->end != end ||
+      module->name != name) {
+    JniTraceModule* created = new JniTraceModule();
+    created->begin = begin;
+    created->end = end;
+    created->load_bias = info->dlpi_addr;
+    created->name = name;
+    created->build_id_size = 0u;
+    for (size_t i = 0; i < info->dlpi_phnum && created->build_id_size == 0u; ++i) {
+      if (info->dlpi_phdr[i].p_type == PT_NOTE) {
+        ReadBuildId(info, info->dlpi_phdr[i], created);
+      }
+    }
+    module = created;
+  }
+  state->next->modules.push_back(module);
+  return 0;
+}
+
+int GenerationCallback(dl_phdr_info* info, size_t size, void* data) {
+  ModuleSnapshot* generation = reinterpret_cast<ModuleSnapshot*>(data);
+  if (HasLoadCounters(size)) {
+    generation->adds = info->dlpi_adds;
+    generation->subs = info->dlpi_subs;
+  }
+  // The counters are the same in every entry, one is enough.
+  return 1;
+}
+
+const ModuleSnapshot* Refresh() {
+  std::lock_guard<std::mutex> lock(gModuleRebuildLock);
+  const ModuleSnapshot* current = gModuleSnapshot.load(std::memory_order_relaxed);
+  if (current != nullptr) {
+    ModuleSnapshot generation;
+    dl_iterate_phdr(GenerationCallback, &generation);
+    if (generation.adds == current->adds && generation.subs == current->subs) {
+      return current;
+    }
+  }
+  ModuleSnapshot* next = new ModuleSnapshot();
+  next->generation = current != nullptr ? current->generation + 1u : 0u;
+  RebuildState state = {current, next};
+  dl_iterate_phdr(RebuildCallback, &state);
+  std::sort(next->modules.begin(),
+            next->modules.end(),
+            [](const JniTraceModule* lhs, const JniTraceModule* rhs) {
+              return lhs->begin < rhs->begin;
+            });
+  gModuleSnapshot.store(next, std::memory_order_release);
+  return next;
+}
+
+}  // namespace
+
+const JniTraceModule* JniTraceModuleIndex::Find(uintptr_t addr) {
+  const ModuleSnapshot* snapshot = gModuleSnapshot.load(std::memory_order_acquire);
+  if (LIKELY(snapshot != nullptr)) {
+    const JniTraceModule* module = Lookup(snapshot, addr);
+    if (LIKELY(module != nullptr)) {
+      return module;
+    }
+    if (MissSlot(addr).load(std::memory_order_relaxed) == MissKey(addr, snapshot)) {
+      return nullptr;
+    }
+  }
+  // Either the first lookup or a library loaded since the last rebuild.
+  const ModuleSnapshot* current = Refresh();
+  const JniTraceModule* module = Lookup(current, addr);
+  if (module == nullptr) {
+    MissSlot(addr).store(MissKey(addr, current), std::memory_order_relaxed);
+  }
+  return module;
+}
+
+}  // namespace art
@@ -0,0 +1,460 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "android-base/parseint.h"
+#include "base/bit_utils.h"
+#include "base/globals.h"
+#include "base/logging.h"
+#include "base/time_utils.h"
+#include "jni_trace.h"
+#include "utils/Log.h"
+
+namespace art {
+
+// Trace sinks.
+//
+// Every sink receives whole lines, usually a batch of a flush at a time, and is shared by all
+// threads. None of them waits for whoever consumes the trace: the file and memfd sinks only
+// copy into shared memory, and the socket sink never blocks and buffers a bounded backlog.
+
+namespace {
+
+// Largest text of one log message; logd allows a little more, minus the tag and the header.
+static constexpr size_t kLogcatMaxPayload = 4000;
+// The file sink grows the file, and its mapping, by this much at a time.
+static constexpr size_t kMappedFileGrowth = 1 * MB;
+static constexpr size_t kDefaultMemfdRingBytes = 4 * MB;
+// Text the socket sink keeps while the collector is not reading, beyond it lines are dropped.
+static constexpr size_t kMaxSocketBacklog = 1 * MB;
+static constexpr uint64_t kSocketReconnectIntervalNs = 1000000000u;
+
+// Start of the file and memfd sinks. A collector reads `used` with acquire semantics and then
+// the text before it; the writers publish with a release store once the text is copied.
+struct SharedSinkHeader {
+  char magic[8];              // "JNITRACE"
+  uint32_t header_size;       // Text starts here.
+  uint32_t flags;             // kSharedSinkRing for a ring.
+  uint64_t capacity;          // Ring size in bytes, 0 for a file.
+  std::atomic<uint64_t> used;  // Bytes ever written. A ring holds the last `capacity` of them.
+};
+
+static constexpr char kSharedSinkMagic[8] = {'J', 'N', 'I', 'T', 'R', 'A', 'C', 'E'};
+static constexpr uint32_t kSharedSinkRing = 1u;
+static constexpr size_t kSharedSinkHeaderSize = 64;
+static_assert(sizeof(SharedSinkHeader) <= kSharedSinkHeaderSize, "SharedSinkHeader too large");
+
+class LogcatSink : public JniTraceSink {
+ public:
+  // Packs lines into as few messages as possible and splits lines too long for one.
+  void Write(const std::string& text) override {
+    size_t begin = 0;
+    while (begin < text.size()) {
+      size_t end = begin;
+      while (end < text.size()) {
+        const size_t line_end = text.find('\n', end);
+        const size_t next = line_end == std::string::npos ? text.size() : line_end + 1u;
+        if (next - begin > kLogcatMaxPayload) {
+          break;
+        }
+        end = next;
+      }
+      if (end == begin) {
+        // A single line over the limit.
+        end = begin + kLogcatMaxPayload;
+      }
+      // Logcat ends every message with a newline of its own.
+      size_t length = end - begin;
+      if (text[end - 1u] == '\n') {
+        --length;
+      }
+      const std::string message = text.substr(begin, length);
+      __android_log_write(ANDROID_LOG_DEBUG, LOG_TAG, message.c_str());
+      begin = end;
+    }
+  }
+};
+
+// Holds flock(LOCK_EX) on a file for its scope. The lock goes away with the process, a writer
+// killed mid-write does not block the others.
+class ScopedFileLock {
+ public:
+  explicit ScopedFileLock(int fd)
+      : fd_(fd), locked_(TEMP_FAILURE_RETRY(flock(fd, LOCK_EX)) == 0) {}
+
+  ~ScopedFileLock() {
+    if (locked_) {
+      flock(fd_, LOCK_UN);
+    }
+  }
+
+  bool IsLocked() const {
+    return locked_;
+  }
+
+ private:
+  const int fd_;
+  const bool locked_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedFileLock);
+};
+
+// Append-only text after a SharedSinkHeader. Copying into the mapping costs no system call;
+// the file grows a megabyte at a time. Reopening a file carries on after its text.
+//
+// Every process of the package maps the same file, so `used` is only read and advanced with
+// the file locked; a writer that finds the file grown by another process maps the new size
+// before copying. The lock is taken once per batch, not per line.
+class MappedFileSink : public JniTraceSink {
+ public:
+  static MappedFileSink* Open(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      PLOG(WARNING) << "jnitrace could not open " << path;
+      return nullptr;
+    }
+    MappedFileSink* sink = nullptr;
+    {
+      // Another process may be creating the header or appending meanwhile.
+      ScopedFileLock file_lock(fd);
+      if (file_lock.IsLocked()) {
+        sink = Map(fd, path);
+      } else {
+        PLOG(WARNING) << "jnitrace could not lock " << path;
+      }
+    }
+    if (sink == nullptr) {
+      close(fd);
+    }
+    return sink;
+  }
+
+  void Write(const std::string& text) override {
+    std::lock_guard<std::mutex> lock(lock_);
+    ScopedFileLock file_lock(fd_);
+    if (!file_lock.IsLocked()) {
+      return;
+    }
+    const uint64_t used = Header()->used.load(std::memory_order_acquire);
+    const size_t needed = kSharedSinkHeaderSize + used + text.size();
+    if (needed > size_ && !Grow(needed)) {
+      return;
+    }
+    memcpy(base_ + kSharedSinkHeaderSize + used, text.data(), text.size());
+    Header()->used.store(used + text.size(), std::memory_order_release);
+  }
+
+ private:
+  MappedFileSink(int fd, uint8_t* base, size_t size) : fd_(fd), base_(base), size_(size) {}
+
+  SharedSinkHeader* Header() {
+    return reinterpret_cast<SharedSinkHeader*>(base_);
+  }
+
+  // Called with the file locked, the caller closes `fd` on failure.
+  static MappedFileSink* Map(int fd, const std::string& path) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      return nullptr;
+    }
+    const bool existing = st.st_size != 0;
+    const size_t size = existing ? st.st_size : kMappedFileGrowth;
+    // Also backs the holes of a file left sparse by an older writer.
+    if (!Allocate(fd, size)) {
+      PLOG(WARNING) << "jnitrace could not size " << path;
+      return nullptr;
+    }
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+      PLOG(WARNING) << "jnitrace could not map " << path;
+      return nullptr;
+    }
+    SharedSinkHeader* header = reinterpret_cast<SharedSinkHeader*>(base);
+    if (existing &&
+        (size < kSharedSinkHeaderSize ||
+         memcmp(header->magic, kSharedSinkMagic, sizeof(kSharedSinkMagic)) != 0 ||
+         header->capacity != 0u ||
+         kSharedSinkHeaderSize + header->used.load(std::memory_order_relaxed) > size)) {
+      LOG(WARNING) << "jnitrace will not append to " << path << ", it is not a trace file";
+      munmap(base, size);
+      return nullptr;
+    }
+    if (!existing) {
+      memcpy(header->magic, kSharedSinkMagic, sizeof(kSharedSinkMagic));
+      header->header_size = kSharedSinkHeaderSize;
+      header->flags = 0u;
+      header->capacity = 0u;
+      header->used.store(0u, std::memory_order_release);
+    }
+    return new MappedFileSink(fd, reinterpret_cast<uint8_t*>(base), size);
+  }
+
+  // Reserves the blocks of the first `size` bytes. A sparse file would raise SIGBUS on a store
+  // into the mapping once the disk is full, ftruncate alone is not enough.
+  static bool Allocate(int fd, size_t size) {
+    const int error = posix_fallocate(fd, 0, size);
+    if (error != 0) {
+      errno = error;
+      return false;
+    }
+    return true;
+  }
+
+  // Called with the file locked. Another process may have grown the file already, the mapping
+  // then covers the whole file.
+  bool Grow(size_t needed) {
+    struct stat st;
+    if (fstat(fd_, &st) != 0) {
+      return false;
+    }
+    const size_t size = std::max(static_cast<size_t>(st.st_size),
+                                 RoundUp(needed, kMappedFileGrowth));
+    if (!Allocate(fd_, size)) {
+      return false;
+    }
+    void* base = mremap(base_, size_, size, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED) {
+      return false;
+    }
+    base_ = reinterpret_cast<uint8_t*>(base);
+    size_ = size;
+    return true;
+  }
+
+  std::mutex lock_;
+  const int fd_;
+  uint8_t* base_;
+  size_t size_;
+};
+
+// Ring of text after a SharedSinkHeader in a memfd. A collector maps /proc/<pid>/fd/<fd>,
+// copies out the text between used - capacity and used, and checks `used` again to discard
+// what was overwritten meanwhile. The oldest text is overwritten when the collector lags.
+class MemfdRingSink : public JniTraceSink {
+ public:
+  static MemfdRingSink* Open(size_t capacity) {
+    const int fd = memfd_create("jnitrace", MFD_CLOEXEC);
+    if (fd < 0) {
+      PLOG(WARNING) << "jnitrace could not create a memfd";
+      return nullptr;
+    }
+    const size_t size = kSharedSinkHeaderSize + capacity;
+    if (ftruncate(fd, size) != 0) {
+      PLOG(WARNING) << "jnitrace could not size its memfd";
+      close(fd);
+      return nullptr;
+    }
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+      PLOG(WARNING) << "jnitrace could not map its memfd";
+      close(fd);
+      return nullptr;
+    }
+    SharedSinkHeader* header = reinterpret_cast<SharedSinkHeader*>(base);
+    memcpy(header->magic, kSharedSinkMagic, sizeof(kSharedSinkMagic));
+    header->header_size = kSharedSinkHeaderSize;
+    header->flags = kSharedSinkRing;
+    header->capacity = capacity;
+    header->used.store(0u, std::memory_order_release);
+    LOG(INFO) << "jnitrace ring of " << capacity << " bytes at /proc/" << getpid() << "/fd/"
+              << fd;
+    return new MemfdRingSink(reinterpret_cast<uint8_t*>(base), capacity);
+  }
+
+  void Write(const std::string& text) override {
+    std::lock_guard<std::mutex> lock(lock_);
+    // Only the tail of an oversized batch fits.
+    const size_t size = std::min(text.size(), capacity_);
+    const char* data = text.data() + text.size() - size;
+    const uint64_t used = Header()->used.load(std::memory_order_relaxed);
+    const size_t offset = (used + text.size() - size) % capacity_;
+    const size_t first = std::min(size, capacity_ - offset);
+    memcpy(text_ + offset, data, first);
+    memcpy(text_, data + first, size - first);
+    Header()->used.store(used + text.size(), std::memory_order_release);
+  }
+
+ private:
+  MemfdRingSink(uint8_t* base, size_t capacity)
+      : base_(base), text_(base + kSharedSinkHeaderSize), capacity_(capacity) {}
+
+  SharedSinkHeader* Header() {
+    return reinterpret_cast<SharedSinkHeader*>(base_);
+  }
+
+  std::mutex lock_;
+  uint8_t* const base_;
+  uint8_t* const text_;
+  const size_t capacity_;
+};
+
+// Streams the text to a collector listening on a Unix socket. Sends never block: what the
+// socket does not take is kept, up to kMaxSocketBacklog, and sent first next time. A lost
+// collector is reconnected to at most once a second.
+class SocketSink : public JniTraceSink {
+ public:
+  explicit SocketSink(const std::string& path) : path_(path) {}
+
+  void Write(const std::string& text) override {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (fd_ < 0 && !Connect()) {
+      dropped_ += text.size();
+      return;
+    }
+    if (!backlog_.empty() && !Send(&backlog_)) {
+      dropped_ += text.size();
+      return;
+    }
+    if (!backlog_.empty()) {
+      if (backlog_.size() + text.size() > kMaxSocketBacklog) {
+        dropped_ += text.size();
+      } else {
+        backlog_.append(text);
+      }
+      return;
+    }
+    std::string pending = text;
+    if (Send(&pending)) {
+      backlog_ = std::move(pending);
+    } else {
+      dropped_ += pending.size();
+    }
+  }
+
+ private:
+  bool Connect() {
+    const uint64_t now = NanoTime();
+    if (last_connect_ns_ != 0u && now - last_connect_ns_ < kSocketReconnectIntervalNs) {
+      return false;
+    }
+    last_connect_ns_ = now;
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path_.empty() || path_.size() >= sizeof(addr.sun_path)) {
+      return false;
+    }
+    memcpy(addr.sun_path, path_.data(), path_.size());
+    socklen_t length = offsetof(sockaddr_un, sun_path) + path_.size();
+    if (path_[0] == '@') {
+      addr.sun_path[0] = '\0';
+    } else {
+      ++length;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+      return false;
+    }
+    if (TEMP_FAILURE_RETRY(connect(fd, reinterpret_cast<sockaddr*>(&addr), length)) != 0) {
+      close(fd);
+      return false;
+    }
+    fd_ = fd;
+    if (dropped_ != 0u) {
+      LOG(WARNING) << "jnitrace dropped " << dropped_ << " bytes while " << path_
+                   << " was not reading";
+      dropped_ = 0u;
+    }
+    backlog_.clear();
+    return true;
+  }
+
+  // Sends what the socket takes and erases it from `text`. Returns false, closing the socket,
+  // if the collector went away.
+  bool Send(std::string* text) {
+    const ssize_t sent =
+        TEMP_FAILURE_RETRY(send(fd_, text->data(), text->size(), MSG_NOSIGNAL | MSG_DONTWAIT));
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      close(fd_);
+      fd_ = -1;
+      backlog_.clear();
+      return false;
+    }
+    text->erase(0, sent);
+    return true;
+  }
+
+  std::mutex lock_;
+  const std::string path_;
+  int fd_ = -1;
+  uint64_t last_connect_ns_ = 0u;
+  std::string backlog_;
+  uint64_t dropped_ = 0u;
+};
+
+JniTraceSink* OpenSink(const std::string& spec) {
+  if (spec.empty() || spec == "logcat") {
+    return new LogcatSink();
+  }
+  if (spec.compare(0, 5, "file:") == 0) {
+    return MappedFileSink::Open(spec.substr(5));
+  }
+  if (spec == "memfd") {
+    return MemfdRingSink::Open(kDefaultMemfdRingBytes);
+  }
+  if (spec.compare(0, 6, "memfd:") == 0) {
+    size_t capacity;
+    if (!android::base::ParseUint(spec.substr(6), &capacity) || capacity == 0u) {
+      return nullptr;
+    }
+    return MemfdRingSink::Open(RoundUp(capacity, kPageSize));
+  }
+  if (spec.compare(0, 7, "socket:") == 0) {
+    return new SocketSink(spec.substr(7));
+  }
+  return nullptr;
+}
+
+std::mutex gSinkLock;
+
+// By spec, never freed; configs of any version may point at them.
+std::map<std::string, JniTraceSink*>& Sinks() {
+  static auto* sinks = new std::map<std::string, JniTraceSink*>();
+  return *sinks;
+}
+
+}  // namespace
+
+JniTraceSink* JniTraceSink::Get(const std::string& spec) {
+  std::lock_guard<std::mutex> lock(gSinkLock);
+  std::map<std::string, JniTraceSink*>& sinks = Sinks();
+  auto it = sinks.find(spec);
+  if (it != sinks.end()) {
+    return it->second;
+  }
+  JniTraceSink* sink = OpenSink(spec);
+  if (sink == nullptr) {
+    LOG(WARNING) << "jnitrace sink '" << spec << "' unavailable, tracing to logcat";
+    auto logcat = sinks.find(std::string());
+    sink = logcat != sinks.end() ? logcat->second : new LogcatSink();
+    sinks.emplace(std::string(), sink);
+  }
+  sinks.emplace(spec, sink);
+  return sink;
+}
+
+JniTraceSink* JniTraceConfig::Sink() const {
+  JniTraceSink* sink = sink_.load(std::memory_order_acquire);
+  if (UNLIKELY(sink == nullptr)) {
+    sink = JniTraceSink::Get(item.traceSink);
+    sink_.store(sink, std::memory_order_release);
+  }
+  return sink;
+}
+
+}  // namespace art
@@ -0,0 +1,481 @@
+#include "jni_utf.h"
+
+#include <string.h>
+
+// The NEON kernels are off until they have been built for arm64 and compared there against
+// the scalar versions; define ART_JNI_UTF_NEON to try them. Until then arm64 keeps the scalar
+// code, like targets other than x86_64.
+#if defined(__aarch64__) && defined(ART_JNI_UTF_NEON)
+#define JNI_UTF_USE_NEON 1
+#else
+#define JNI_UTF_USE_NEON 0
+#endif
+
+#if JNI_UTF_USE_NEON
+#include <arm_neon.h>
+#elif defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "base/macros.h"
+#include "base/memory_tool.h"
+#include "dex/utf.h"
+
+namespace art {
+
+// Strings are converted a block of chars at a time. A block of ASCII chars, 1 to 0x7f, is
+// narrowed to one byte per char with a few vector instructions; a block without surrogates is
+// counted in vector registers. Anything else, a NUL or a surrogate, sends that one block through
+// the scalar code, so a stray non-ASCII char costs one block and not the rest of the string.
+//
+// Input to NewStringUTF is scanned the same way: one pass finds the terminating NUL and whether
+// any byte has its top bit set, and for non-ASCII input a second pass validates and counts, only
+// decoding the blocks that hold such bytes.
+//
+// x86_64 uses SSE2 and, where the CPU has it, AVX2; arm64 has NEON versions, see
+// JNI_UTF_USE_NEON. Other targets keep the scalar versions of dex/utf.h.
+
+// ScanWith reads the aligned blocks around the string, which no page boundary separates from
+// it but which ASan and HWASan report as out of bounds. Everything it is inlined into carries
+// the attribute as well, an instrumented caller would not inline it.
+#ifndef ATTRIBUTE_NO_SANITIZE_HWADDRESS
+#if defined(__clang__)
+#define ATTRIBUTE_NO_SANITIZE_HWADDRESS __attribute__((no_sanitize("hwaddress")))
+#else
+#define ATTRIBUTE_NO_SANITIZE_HWADDRESS
+#endif
+#endif
+#define ATTRIBUTE_NO_SANITIZE_SCAN ATTRIBUTE_NO_SANITIZE_ADDRESS ATTRIBUTE_NO_SANITIZE_HWADDRESS
+
+namespace {
+
+// One char of CountUtf8Bytes(), moving `*chars` past it and past its trail surrogate if any.
+ALWAYS_INLINE inline size_t CountCharBytes(const uint16_t** chars, const uint16_t* end) {
+  const uint16_t ch = *(*chars)++;
+  if (LIKELY(ch != 0 && ch < 0x80)) {
+    return 1u;
+  }
+  if (ch < 0x800) {
+    return 2u;
+  }
+  if (ch >= 0xd800 && ch < 0xdc00 && *chars < end) {
+    const uint16_t ch2 = **chars;
+    if (ch2 >= 0xdc00 && ch2 < 0xe000) {
+      ++*chars;
+      return 4u;
+    }
+  }
+  return 3u;
+}
+
+// One char of ConvertUtf16ToModifiedUtf8(), with the same surrogate handling as CountCharBytes.
+ALWAYS_INLINE inline void EncodeChar(char** out, const uint16_t** in, const uint16_t* end) {
+  const uint16_t ch = *(*in)++;
+  char* p = *out;
+  if (ch > 0 && ch <= 0x7f) {
+    *p++ = static_cast<char>(ch);
+  } else if (ch >= 0xd800 && ch <= 0xdbff && *in < end && **in >= 0xdc00 && **in <= 0xdfff) {
+    const uint32_t code_point = (ch << 10) + *(*in)++ - 0x035fdc00;
+    *p++ = static_cast<char>((code_point >> 18) | 0xf0);
+    *p++ = static_cast<char>(((code_point >> 12) & 0x3f) | 0x80);
+    *p++ = static_cast<char>(((code_point >> 6) & 0x3f) | 0x80);
+    *p++ = static_cast<char>((code_point & 0x3f) | 0x80);
+  } else if (ch > 0x07ff) {
+    *p++ = static_cast<char>((ch >> 12) | 0xe0);
+    *p++ = static_cast<char>(((ch >> 6) & 0x3f) | 0x80);
+    *p++ = static_cast<char>((ch & 0x3f) | 0x80);
+  } else {
+    *p++ = static_cast<char>((ch >> 6) | 0xc0);
+    *p++ = static_cast<char>((ch & 0x3f) | 0x80);
+  }
+  *out = p;
+}
+
+// Drivers shared by the instruction sets. `count_block(chars, &bytes)` adds the length of
+// kLanes chars and returns true, or returns false if they hold a surrogate.
+// `narrow_block(in, out)` writes kLanes ASCII chars as bytes and returns true, or returns false
+// without writing if they are not all ASCII.
+template <size_t kLanes, typename CountBlock>
+ALWAYS_INLINE inline size_t CountWith(const uint16_t* chars,
+                                      size_t char_count,
+                                      CountBlock count_block) {
+  const uint16_t* const end = chars + char_count;
+  size_t bytes = 0u;
+  while (static_cast<size_t>(end - chars) >= kLanes) {
+    if (LIKELY(count_block(chars, &bytes))) {
+      chars += kLanes;
+      continue;
+    }
+    // A pair may straddle the end of the block, the next block then starts after it.
+    const uint16_t* const block_end = chars + kLanes;
+    while (chars < block_end) {
+      bytes += CountCharBytes(&chars, end);
+    }
+  }
+  while (chars < end) {
+    bytes += CountCharBytes(&chars, end);
+  }
+  return bytes;
+}
+
+template <size_t kLanes, typename NarrowBlock>
+ALWAYS_INLINE inline void ConvertWith(char* out,
+                                      const uint16_t* in,
+                                      size_t char_count,
+                                      NarrowBlock narrow_block) {
+  const uint16_t* const end = in + char_count;
+  while (static_cast<size_t>(end - in) >= kLanes) {
+    if (LIKELY(narrow_block(in, out))) {
+      in += kLanes;
+      out += kLanes;
+      continue;
+    }
+    const uint16_t* const block_end = in + kLanes;
+    while (in < block_end) {
+      EncodeChar(&out, &in, end);
+    }
+  }
+  while (in < end) {
+    EncodeChar(&out, &in, end);
+  }
+}
+
+// One sequence of VisitModifiedUtf8Chars(), adding its UTF-16 chars to `*length`. Returns false
+// where that rejects the input.
+ALWAYS_INLINE inline bool DecodeSequence(const char** utf8,
+                                         const char* end,
+                                         bool reject_ascii_multibyte,
+                                         size_t* length) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(*utf8);
+  const size_t available = end - *utf8;
+  const uint8_t one = p[0];
+  size_t size;
+  uint32_t ch;
+  if ((one & 0x80) == 0) {
+    *utf8 += 1;
+    *length += 1u;
+    return true;
+  }
+  // Like GetUtf16FromUtf8(), the continuation bytes are not checked.
+  if ((one & 0x20) == 0) {
+    size = 2u;
+    ch = available >= 2u ? ((one & 0x1f) << 6) | (p[1] & 0x3f) : 0u;
+  } else if ((one & 0x10) == 0) {
+    size = 3u;
+    ch = available >= 3u ? ((one & 0x0f) << 12) | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f) : 0u;
+  } else {
+    // A surrogate pair, never ASCII.
+    size = 4u;
+    ch = 0u;
+  }
+  if (available < size || (reject_ascii_multibyte && ch - 1u < 0x7fu)) {
+    return false;
+  }
+  *utf8 += size;
+  *length += size == 4u ? 2u : 1u;
+  return true;
+}
+
+// `scan_block(block, &nul, &high)` sets one group of kBitsPerByte bits per byte of the kBytes
+// aligned bytes at `block`: in `nul` for the zero bytes and in `high` for the bytes with the
+// top bit set. `has_high(p)` tells whether any of the kBytes bytes at `p` has the top bit set.
+template <size_t kBytes, size_t kBitsPerByte, typename ScanBlock>
+ATTRIBUTE_NO_SANITIZE_SCAN ALWAYS_INLINE inline size_t ScanWith(const char* utf8, bool* is_ascii, ScanBlock scan_block) {
+  // Aligned loads never cross into the next page, so reading the bytes around the string is
+  // safe; their bits are cleared.
+  const size_t misalign = reinterpret_cast<uintptr_t>(utf8) & (kBytes - 1u);
+  const char* block = utf8 - misalign;
+  uint64_t nul;
+  uint64_t high;
+  scan_block(block, &nul, &high);
+  const uint64_t string_bits = ~UINT64_C(0) << (misalign * kBitsPerByte);
+  nul &= string_bits;
+  high &= string_bits;
+  bool ascii = true;
+  while (nul == 0u) {
+    ascii = ascii && high == 0u;
+    block += kBytes;
+    scan_block(block, &nul, &high);
+  }
+  const size_t index = __builtin_ctzll(nul) / kBitsPerByte;
+  const uint64_t before_nul = (UINT64_C(1) << (index * kBitsPerByte)) - 1u;
+  *is_ascii = ascii && (high & before_nul) == 0u;
+  return block + index - utf8;
+}
+
+template <size_t kBytes, typename HasHigh>
+ALWAYS_INLINE inline size_t CountCharsWith(const char* utf8,
+                                           size_t byte_count,
+                                           bool reject_ascii_multibyte,
+                                           HasHigh has_high) {
+  const char* const end = utf8 + byte_count;
+  size_t length = 0u;
+  while (static_cast<size_t>(end - utf8) >= kBytes) {
+    if (LIKELY(!has_high(utf8))) {
+      utf8 += kBytes;
+      length += kBytes;
+      continue;
+    }
+    // A sequence may straddle the end of the block, the next block then starts after it.
+    const char* const block_end = utf8 + kBytes;
+    while (utf8 < block_end) {
+      if (!DecodeSequence(&utf8, end, reject_ascii_multibyte, &length)) {
+        return 0u;
+      }
+    }
+  }
+  while (utf8 < end) {
+    if (!DecodeSequence(&utf8, end, reject_ascii_multibyte, &length)) {
+      return 0u;
+    }
+  }
+  return length;
+}
+
+#if JNI_UTF_USE_NEON
+
+// NEON has no movemask. Narrowing each 16-bit lane by 4 keeps one nibble of each byte, so a
+// byte mask of all ones or zeros becomes 4 bits per byte.
+ATTRIBUTE_NO_SANITIZE_SCAN ALWAYS_INLINE inline uint64_t ByteMaskNeon(uint8x16_t mask) {
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(mask), 4)), 0);
+}
+
+ATTRIBUTE_NO_SANITIZE_SCAN ALWAYS_INLINE inline void ScanBlockNeon(const char* block, uint64_t* nul, uint64_t* high) {
+  const uint8x16_t bytes = vld1q_u8(reinterpret_cast<const uint8_t*>(block));
+  *nul = ByteMaskNeon(vceqzq_u8(bytes));
+  *high = ByteMaskNeon(vcltzq_s8(vreinterpretq_s8_u8(bytes)));
+}
+
+ALWAYS_INLINE inline bool HasHighNeon(const char* p) {
+  return vmaxvq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(p))) >= 0x80u;
+}
+
+ALWAYS_INLINE inline bool CountBlockNeon(const uint16_t* chars, size_t* bytes) {
+  const uint16x8_t c = vld1q_u16(chars);
+  const uint16x8_t surrogate = vcltq_u16(vsubq_u16(c, vdupq_n_u16(0xd800)), vdupq_n_u16(0x800));
+  if (vmaxvq_u16(surrogate) != 0u) {
+    return false;
+  }
+  // Lanes are all ones where the condition holds, that is -1.
+  const uint16x8_t two_or_more = vorrq_u16(vceqzq_u16(c), vcgeq_u16(c, vdupq_n_u16(0x80)));
+  const uint16x8_t three = vcgeq_u16(c, vdupq_n_u16(0x800));
+  *bytes += vaddvq_u16(vsubq_u16(vsubq_u16(vdupq_n_u16(1), two_or_more), three));
+  return true;
+}
+
+ALWAYS_INLINE inline bool NarrowBlockNeon(const uint16_t* in, char* out) {
+  const uint16x8_t lo = vld1q_u16(in);
+  const uint16x8_t hi = vld1q_u16(in + 8);
+  if (vmaxvq_u16(vmaxq_u16(lo, hi)) > 0x7fu || vminvq_u16(vminq_u16(lo, hi)) == 0u) {
+    return false;
+  }
+  vst1q_u8(reinterpret_cast<uint8_t*>(out), vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+  return true;
+}
+
+#elif defined(__x86_64__)
+
+// SSE2 has no unsigned 16-bit compare; c <= n is a saturating c - n that comes out zero.
+ALWAYS_INLINE inline bool CountBlockSse2(const uint16_t* chars, size_t* bytes) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(chars));
+  const __m128i offset = _mm_sub_epi16(c, _mm_set1_epi16(static_cast<int16_t>(0xd800)));
+  const __m128i surrogate = _mm_cmpeq_epi16(_mm_subs_epu16(offset, _mm_set1_epi16(0x7ff)), zero);
+  if (_mm_movemask_epi8(surrogate) != 0) {
+    return false;
+  }
+  const int below_80 =
+      _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(c, _mm_set1_epi16(0x7f)), zero));
+  const int below_800 =
+      _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_subs_epu16(c, _mm_set1_epi16(0x7ff)), zero));
+  const int nul = _mm_movemask_epi8(_mm_cmpeq_epi16(c, zero));
+  // Three bytes per char, one less below 0x800 and one less again below 0x80 except for NUL.
+  // Each lane sets two mask bits.
+  *bytes += 3u * 8u - (__builtin_popcount(below_80) + __builtin_popcount(below_800) -
+                       __builtin_popcount(nul)) / 2u;
+  return true;
+}
+
+ATTRIBUTE_NO_SANITIZE_SCAN ALWAYS_INLINE inline void ScanBlockSse2(const char* block, uint64_t* nul, uint64_t* high) {
+  const __m128i bytes = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+  *nul = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_setzero_si128())));
+  *high = static_cast<uint32_t>(_mm_movemask_epi8(bytes));
+}
+
+ALWAYS_INLINE inline bool HasHighSse2(const char* p) {
+  return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))) != 0;
+}
+
+ALWAYS_INLINE inline bool NarrowBlockSse2(const uint16_t* in, char* out) {
+  const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+  const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 8));
+  // Chars above 0xff saturate to 0xff, so any non-ASCII char leaves its sign bit set.
+  const __m128i packed = _mm_packus_epi16(lo, hi);
+  if ((_mm_movemask_epi8(packed) |
+       _mm_movemask_epi8(_mm_cmpeq_epi8(packed, _mm_setzero_si128()))) != 0) {
+    return false;
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+  return true;
+}
+
+// Lambdas would not inherit the target attribute, hence the function objects.
+struct CountBlockAvx2 {
+  __attribute__((target("avx2")))
+  bool operator()(const uint16_t* chars, size_t* bytes) const {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chars));
+    const __m256i offset = _mm256_sub_epi16(c, _mm256_set1_epi16(static_cast<int16_t>(0xd800)));
+    const __m256i surrogate =
+        _mm256_cmpeq_epi16(_mm256_subs_epu16(offset, _mm256_set1_epi16(0x7ff)), zero);
+    if (_mm256_movemask_epi8(surrogate) != 0) {
+      return false;
+    }
+    const uint32_t below_80 = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi16(_mm256_subs_epu16(c, _mm256_set1_epi16(0x7f)), zero)));
+    const uint32_t below_800 = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi16(_mm256_subs_epu16(c, _mm256_set1_epi16(0x7ff)), zero)));
+    const uint32_t nul = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(c, zero)));
+    *bytes += 3u * 16u - (__builtin_popcount(below_80) + __builtin_popcount(below_800) -
+                          __builtin_popcount(nul)) / 2u;
+    return true;
+  }
+};
+
+struct NarrowBlockAvx2 {
+  __attribute__((target("avx2")))
+  bool operator()(const uint16_t* in, char* out) const {
+    const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in));
+    const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + 16));
+    // The pack works per 128-bit lane, the permute puts the quarters back in order.
+    const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8);
+    if ((_mm256_movemask_epi8(packed) |
+         _mm256_movemask_epi8(_mm256_cmpeq_epi8(packed, _mm256_setzero_si256()))) != 0) {
+      return false;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), packed);
+    return true;
+  }
+};
+
+struct ScanBlockAvx2 {
+  __attribute__((target("avx2"))) ATTRIBUTE_NO_SANITIZE_SCAN
+  void operator()(const char* block, uint64_t* nul, uint64_t* high) const {
+    const __m256i bytes = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+    *nul = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_setzero_si256())));
+    *high = static_cast<uint32_t>(_mm256_movemask_epi8(bytes));
+  }
+};
+
+struct HasHighAvx2 {
+  __attribute__((target("avx2")))
+  bool operator()(const char* p) const {
+    return _mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))) != 0;
+  }
+};
+
+__attribute__((target("avx2")))
+size_t CountUtf8BytesAvx2(const uint16_t* chars, size_t char_count) {
+  return CountWith<16>(chars, char_count, CountBlockAvx2());
+}
+
+__attribute__((target("avx2")))
+void ConvertUtf16ToModifiedUtf8Avx2(char* out, const uint16_t* in, size_t char_count) {
+  ConvertWith<32>(out, in, char_count, NarrowBlockAvx2());
+}
+
+__attribute__((target("avx2"))) ATTRIBUTE_NO_SANITIZE_SCAN
+size_t ScanModifiedUtf8LengthAvx2(const char* utf8, bool* is_ascii) {
+  return ScanWith<32, 1>(utf8, is_ascii, ScanBlockAvx2());
+}
+
+__attribute__((target("avx2")))
+size_t CountModifiedUtf8CharsAvx2(const char* utf8,
+                                  size_t byte_count,
+                                  bool reject_ascii_multibyte) {
+  return CountCharsWith<32>(utf8, byte_count, reject_ascii_multibyte, HasHighAvx2());
+}
+
+bool HasAvx2() {
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+
+#endif
+
+}  // namespace
+
+size_t CountUtf8BytesFast(const uint16_t* chars, size_t char_count) {
+#if JNI_UTF_USE_NEON
+  return CountWith<8>(chars, char_count, CountBlockNeon);
+#elif defined(__x86_64__)
+  if (HasAvx2()) {
+    return CountUtf8BytesAvx2(chars, char_count);
+  }
+  return CountWith<8>(chars, char_count, CountBlockSse2);
+#else
+  return CountUtf8Bytes(chars, char_count);
+#endif
+}
+
+void ConvertUtf16ToModifiedUtf8Fast(char* utf8_out,
+                                    size_t byte_count,
+                                    const uint16_t* utf16_in,
+                                    size_t char_count) {
+#if JNI_UTF_USE_NEON
+  UNUSED(byte_count);
+  ConvertWith<16>(utf8_out, utf16_in, char_count, NarrowBlockNeon);
+#elif defined(__x86_64__)
+  UNUSED(byte_count);
+  if (HasAvx2()) {
+    ConvertUtf16ToModifiedUtf8Avx2(utf8_out, utf16_in, char_count);
+    return;
+  }
+  ConvertWith<16>(utf8_out, utf16_in, char_count, NarrowBlockSse2);
+#else
+  ConvertUtf16ToModifiedUtf8(utf8_out, byte_count, utf16_in, char_count);
+#endif
+}
+
+ATTRIBUTE_NO_SANITIZE_SCAN
+size_t ScanModifiedUtf8Length(const char* utf8, bool* is_ascii) {
+#if JNI_UTF_USE_NEON
+  return ScanWith<16, 4>(utf8, is_ascii, ScanBlockNeon);
+#elif defined(__x86_64__)
+  if (HasAvx2()) {
+    return ScanModifiedUtf8LengthAvx2(utf8, is_ascii);
+  }
+  return ScanWith<16, 1>(utf8, is_ascii, ScanBlockSse2);
+#else
+  const size_t length = strlen(utf8);
+  *is_ascii = true;
+  for (size_t i = 0; i < length; ++i) {
+    if ((static_cast<uint8_t>(utf8[i]) & 0x80) != 0) {
+      *is_ascii = false;
+      break;
+    }
+  }
+  return length;
+#endif
+}
+
+size_t CountModifiedUtf8CharsFast(const char* utf8,
+                                  size_t byte_count,
+                                  bool reject_ascii_multibyte) {
+#if JNI_UTF_USE_NEON
+  return CountCharsWith<16>(utf8, byte_count, reject_ascii_multibyte, HasHighNeon);
+#elif defined(__x86_64__)
+  if (HasAvx2()) {
+    return CountModifiedUtf8CharsAvx2(utf8, byte_count, reject_ascii_multibyte);
+  }
+  return CountCharsWith<16>(utf8, byte_count, reject_ascii_multibyte, HasHighSse2);
+#else
+  // Blocks of one byte, the scalar decoder for everything.
+  return CountCharsWith<1>(utf8, byte_count, reject_ascii_multibyte, [](const char* p) {
+    return (static_cast<uint8_t>(*p) & 0x80) != 0;
+  });
+#endif
+}
+
+}  // namespace art
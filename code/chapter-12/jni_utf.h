@@ -0,0 +1,36 @@
+#ifndef ART_RUNTIME_JNI_UTF_H_
+#define ART_RUNTIME_JNI_UTF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace art {
+
+// Vectorized versions of the modified UTF-8 helpers of dex/utf.h and jni_internal.cc, used by
+// the JNI string functions; see jni_utf.cc. They produce exactly the results of the scalar
+// versions, including the 4-byte sequences those emit for valid surrogate pairs.
+
+// CountUtf8Bytes(): bytes needed to encode `char_count` chars.
+size_t CountUtf8BytesFast(const uint16_t* chars, size_t char_count);
+
+// ConvertUtf16ToModifiedUtf8(): writes the `byte_count` bytes returned by CountUtf8BytesFast for
+// the same chars. Does not terminate the output.
+void ConvertUtf16ToModifiedUtf8Fast(char* utf8_out,
+                                    size_t byte_count,
+                                    const uint16_t* utf16_in,
+                                    size_t char_count);
+
+// strlen() of `utf8`, also telling in the same pass whether all of its bytes are ASCII.
+size_t ScanModifiedUtf8Length(const char* utf8, bool* is_ascii);
+
+// VisitModifiedUtf8Chars() of jni_internal.cc without visitors: the number of UTF-16 chars in
+// the `byte_count` bytes at `utf8`, or 0 at the first sequence that it rejects. That is a
+// truncated sequence or, with `reject_ascii_multibyte`, a multi-byte encoding of a char from 1
+// to 0x7f, which string compression cannot take.
+size_t CountModifiedUtf8CharsFast(const char* utf8,
+                                  size_t byte_count,
+                                  bool reject_ascii_multibyte);
+
+}  // namespace art
+
+#endif  // ART_RUNTIME_JNI_UTF_H_
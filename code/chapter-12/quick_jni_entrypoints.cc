@@ -20,6 +20,7 @@
 #include "base/casts.h"
 #include "entrypoints/entrypoint_utils-inl.h"
 #include "indirect_reference_table.h"
+#include "jni_trace.h"
 #include "mirror/object-inl.h"
 #include "palette/palette.h"
 #include "thread-inl.h"
@@ -83,12 +84,10 @@ extern uint32_t JniMethodStart(Thread* self) {
   env->SetLocalRefCookie(env->GetLocalsSegmentState());
   // add
   Runtime* runtime=Runtime::Current();
-  if(runtime->GetConfigItem().isJNIMethodPrint){
-      ArtMethod* native_method = *self->GetManagedStack()->GetTopQuickFrame();
-      std::string methodname=native_method->PrettyMethod();
-      if(strstr(methodname.c_str(),runtime->GetConfigItem().jniFuncName)){
-          ALOGD("[ROM] enter jni %s %p",methodname.c_str(),self);
-          runtime->GetConfigItem().jniEnable=true;
+  if(runtime->GetConfigItem()->isJNIMethodPrint){
+      ArtMethod** frame = self->GetManagedStack()->GetTopQuickFrame();
+      if(JniTraceMethodFilter::IsWatched(*frame)){
+          JniTrace::EnterWatchedNative(frame);
       }
   }
   //endadd
@@ -165,21 +164,37 @@ static inline void UnlockJniSynchronizedMethod(jobject locked, Thread* self)
   }
 }
 
+// add
+// Records the leave of a method JniTrace::ExitWatchedNative popped, and flushes the thread's
+// records once that was the last watched native method on its stack. Needs the mutator lock,
+// a flush from native state could not name the methods.
+static void LeaveWatchedNative(ArtMethod* watched_method, uint64_t duration_ns)
+    NO_THREAD_SAFETY_ANALYSIS {
+    if(watched_method == nullptr){
+        return;
+    }
+    JniTrace::RecordWatchedNative(JniTraceEvent::kLeaveNative, watched_method, duration_ns);
+    if(!JniTrace::IsTracingCurrentThread()){
+        JniTrace::FlushCurrentThread();
+    }
+}
+
+// Pops and records at once, for the end hooks that are already runnable.
+static void LeaveWatchedNative(Thread* self) NO_THREAD_SAFETY_ANALYSIS {
+    uint64_t duration_ns = 0u;
+    ArtMethod* watched_method = JniTrace::ExitWatchedNative(self->GetManagedStack()->GetTopQuickFrame(), &duration_ns);
+    LeaveWatchedNative(watched_method, duration_ns);
+}
+//endadd
+
 // Otherwise there's just too much repetitive boilerplate.
 
 extern void JniMethodEnd(uint32_t saved_local_ref_cookie, Thread* self) {
 
     // add
-    Runtime* runtime=Runtime::Current();
-    if(runtime->GetConfigItem().isJNIMethodPrint){
-        ArtMethod* native_method = *self->GetManagedStack()->GetTopQuickFrame();
-        std::string methodname=native_method->PrettyMethod();
-        ALOGD("[ROM] JniMethodEnd jni %s",methodname.c_str());
-        if(strstr(methodname.c_str(),runtime->GetConfigItem().jniFuncName)){
-            runtime->GetConfigItem().jniEnable=false;
-            ALOGD("[ROM] leave jni %s",methodname.c_str());
-        }
-    }
+    // Popped before GoToRunnable, which may suspend; the leave is recorded once runnable.
+    uint64_t duration_ns = 0u;
+    ArtMethod* watched_method = JniTrace::ExitWatchedNative(self->GetManagedStack()->GetTopQuickFrame(), &duration_ns);
     //endadd
 //  ArtMethod* native_method = *self->GetManagedStack()->GetTopQuickFrame();
 //  if(native_method!=nullptr){
@@ -188,6 +203,9 @@ extern void JniMethodEnd(uint32_t saved_local_ref_cookie, Thread* self) {
 //  }
 
   GoToRunnable(self);
+  // add
+  LeaveWatchedNative(watched_method, duration_ns);
+  //endadd
   PopLocalReferences(saved_local_ref_cookie, self);
 }
 
@@ -209,7 +227,14 @@ extern void JniMethodEndSynchronized(uint32_t saved_local_ref_cookie,
 //        std::string methodname=native_method->PrettyMethod();
 //        ALOGD("[ROM] JniMethodEndSynchronized %s",methodname.c_str());
 //    }
+  // add
+  uint64_t duration_ns = 0u;
+  ArtMethod* watched_method = JniTrace::ExitWatchedNative(self->GetManagedStack()->GetTopQuickFrame(), &duration_ns);
+  //endadd
   GoToRunnable(self);
+  // add
+  LeaveWatchedNative(watched_method, duration_ns);
+  //endadd
   UnlockJniSynchronizedMethod(locked, self);  // Must decode before pop.
   PopLocalReferences(saved_local_ref_cookie, self);
 }
@@ -221,15 +246,7 @@ static mirror::Object* JniMethodEndWithReferenceHandleResult(jobject result,
     NO_THREAD_SAFETY_ANALYSIS {
 
     // add
-    Runtime* runtime=Runtime::Current();
-    if(runtime->GetConfigItem().isJNIMethodPrint){
-        ArtMethod* native_method = *self->GetManagedStack()->GetTopQuickFrame();
-        std::string methodname=native_method->PrettyMethod();
-        if(strstr(methodname.c_str(),runtime->GetConfigItem().jniFuncName)){
-            runtime->GetConfigItem().jniEnable=false;
-            ALOGD("[ROM] leave jni %s",methodname.c_str());
-        }
-    }
+    LeaveWatchedNative(self);
     //endadd
 //    ArtMethod* native_method = *self->GetManagedStack()->GetTopQuickFrame();
 //    if(native_method!=nullptr){
@@ -308,6 +325,11 @@ extern uint64_t GenericJniMethodEnd(Thread* self,
     return reinterpret_cast<uint64_t>(JniMethodEndWithReferenceHandleResult(
         result.l, saved_local_ref_cookie, self));
   } else {
+    // add
+    if (LIKELY(normal_native)) {
+      LeaveWatchedNative(self);
+    }
+    //endadd
     if (LIKELY(!critical_native)) {
       PopLocalReferences(saved_local_ref_cookie, self);
     }
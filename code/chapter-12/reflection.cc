@@ -25,6 +25,7 @@
 #include "indirect_reference_table-inl.h"
 #include "jni/java_vm_ext.h"
 #include "jni/jni_internal.h"
+#include "jni_trace.h"
 #include "jvalue-inl.h"
 #include "mirror/class-inl.h"
 #include "mirror/executable.h"
@@ -43,6 +44,54 @@ namespace {
 
 using android::base::StringPrintf;
 
+// Parameter shorties of the most common JNI up-calls, which get an unrolled
+// BuildArgArrayFromVarArgs each. The return type is left out as it does not change how the
+// arguments are passed.
+#define VARARGS_SPECIALIZED_PARAMS(V) \
+  V()                                 \
+  V('I')                              \
+  V('J')                              \
+  V('L')                              \
+  V('Z')                              \
+  V('I', 'I')                         \
+  V('I', 'L')                         \
+  V('L', 'I')                         \
+  V('L', 'L')                         \
+  V('L', 'L', 'L')
+
+static constexpr size_t kMaxSpecializedParams = 3u;
+
+// Count of the parameters, then their shorty chars.
+template <typename... Params>
+constexpr uint32_t ShortyParamsKey(Params... params) {
+  static_assert(sizeof...(params) <= kMaxSpecializedParams, "Key too wide");
+  uint32_t key = sizeof...(params);
+  ((key = (key << 8) | static_cast<uint8_t>(params)), ...);
+  return key;
+}
+
+// The type a value of the shorty char `kType` is promoted to in a va_list.
+template <char kType>
+struct VarArgType {
+  using Type = jint;
+};
+template <>
+struct VarArgType<'F'> {
+  using Type = jdouble;
+};
+template <>
+struct VarArgType<'D'> {
+  using Type = jdouble;
+};
+template <>
+struct VarArgType<'J'> {
+  using Type = jlong;
+};
+template <>
+struct VarArgType<'L'> {
+  using Type = jobject;
+};
+
 class ArgArray {
  public:
   ArgArray(const char* shorty, uint32_t shorty_len)
@@ -103,10 +152,57 @@ class ArgArray {
     AppendWide(jv.j);
   }
 
+  template <char kType>
+  ALWAYS_INLINE void AppendVarArg(const ScopedObjectAccessAlreadyRunnable& soa,
+                                  typename VarArgType<kType>::Type value)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    if constexpr (kType == 'L') {
+      Append(soa.Decode<mirror::Object>(value));
+    } else if constexpr (kType == 'F') {
+      AppendFloat(value);
+    } else if constexpr (kType == 'D') {
+      AppendDouble(value);
+    } else if constexpr (kType == 'J') {
+      AppendWide(value);
+    } else {
+      Append(value);
+    }
+  }
+
+  // BuildArgArrayFromVarArgs for a shorty with the parameters `kParams`.
+  template <char... kParams>
+  void BuildArgArrayFromVarArgsFor(const ScopedObjectAccessAlreadyRunnable& soa,
+                                   ObjPtr<mirror::Object> receiver,
+                                   va_list ap)
+      REQUIRES_SHARED(Locks::mutator_lock_) {
+    DCHECK_EQ(shorty_len_, sizeof...(kParams) + 1u);
+    if (receiver != nullptr) {
+      Append(receiver);
+    }
+    // The comma operator reads the arguments in order.
+    (AppendVarArg<kParams>(soa, va_arg(ap, typename VarArgType<kParams>::Type)), ...);
+  }
+
   void BuildArgArrayFromVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,
                                 ObjPtr<mirror::Object> receiver,
                                 va_list ap)
       REQUIRES_SHARED(Locks::mutator_lock_) {
+    if (shorty_len_ <= kMaxSpecializedParams + 1u) {
+      uint32_t key = shorty_len_ - 1u;
+      for (size_t i = 1; i < shorty_len_; ++i) {
+        key = (key << 8) | static_cast<uint8_t>(shorty_[i]);
+      }
+      switch (key) {
+#define SPECIALIZED_PARAMS_CASE(...)                               \
+        case ShortyParamsKey(__VA_ARGS__):                         \
+          BuildArgArrayFromVarArgsFor<__VA_ARGS__>(soa, receiver, ap); \
+          return;
+        VARARGS_SPECIALIZED_PARAMS(SPECIALIZED_PARAMS_CASE)
+#undef SPECIALIZED_PARAMS_CASE
+        default:
+          break;
+      }
+    }
     // Set receiver if non-null (method is not static)
     if (receiver != nullptr) {
       Append(receiver);
@@ -217,47 +313,150 @@ class ArgArray {
   }
 
 
-    void VarArgsShowArg(const ScopedObjectAccessAlreadyRunnable& soa,
-                        va_list ap)
+    // Records every argument of the va_list into the payload of a jnitrace record, each
+    // primitive with its exact type.
+    void VarArgsRecordArg(const ScopedObjectAccessAlreadyRunnable& soa,
+                          va_list ap,
+                          JniTracePayloadWriter* writer)
     REQUIRES_SHARED(Locks::mutator_lock_) {
-            std::stringstream ss;
             for (size_t i = 1; i < shorty_len_; ++i) {
                 switch (shorty_[i]) {
                     case 'Z':
+                        writer->PutValue(JniTraceField::kBoolean, static_cast<jboolean>(va_arg(ap, jint)));
+                        break;
                     case 'B':
+                        writer->PutValue(JniTraceField::kByte, static_cast<jbyte>(va_arg(ap, jint)));
+                        break;
                     case 'C':
+                        writer->PutValue(JniTraceField::kChar, static_cast<jchar>(va_arg(ap, jint)));
+                        break;
                     case 'S':
+                        writer->PutValue(JniTraceField::kShort, static_cast<jshort>(va_arg(ap, jint)));
+                        break;
                     case 'I':
-                        ss<<"jnitrace"<<"           |:     jint         : "<<va_arg(ap, jint)<<"\n";
+                        writer->PutValue(JniTraceField::kInt, va_arg(ap, jint));
                         break;
                     case 'F':
-                        ss<<"jnitrace"<<"           |:     jfloat       : "<<va_arg(ap, jdouble)<<"\n";
+                        writer->PutValue(JniTraceField::kFloat, static_cast<jfloat>(va_arg(ap, jdouble)));
                         break;
-                    case 'L':{
-                        jobject obj=va_arg(ap, jobject);
-                        ObjPtr<mirror::Object> receiver =soa.Decode<mirror::Object>(obj);
-                        if(receiver==nullptr){
-                            ss<<"jnitrace"<<"           |:     jobject      : null\n";
-                            break;
-                        }
-                        ObjPtr<mirror::Class> cls=receiver->GetClass();
-                        if (cls->DescriptorEquals("Ljava/lang/String;")){
-                            ObjPtr<mirror::String> argStr =soa.Decode<mirror::String>(obj);
-                            ss<<"jnitrace"<<"           |:     jstring      : "<<(const char*)argStr->GetValue()<<"\n";
-                        }else{
-                            ss<<"jnitrace"<<"           |:     jobject      : "<<&obj<<"\n";
-                        }
+                    case 'L':
+                        RecordObject(soa, va_arg(ap, jobject), writer);
                         break;
-                    }
                     case 'D':
-                        ss<<"jnitrace"<<"           |:     jdouble       : "<<va_arg(ap, jdouble)<<"\n";
+                        writer->PutValue(JniTraceField::kDouble, va_arg(ap, jdouble));
                         break;
                     case 'J':
-                        ss<<"jnitrace"<<"           |:     jlong         : "<<va_arg(ap, jlong)<<"\n";
+                        writer->PutValue(JniTraceField::kLong, va_arg(ap, jlong));
                         break;
                 }
             }
-            ALOGD("%s",ss.str().c_str());
+    }
+
+    // Same as VarArgsRecordArg() for the jvalue array of the Call*MethodA functions.
+    void JValuesRecordArg(const ScopedObjectAccessAlreadyRunnable& soa,
+                          const jvalue* args,
+                          JniTracePayloadWriter* writer)
+    REQUIRES_SHARED(Locks::mutator_lock_) {
+            for (size_t i = 1, args_offset = 0; i < shorty_len_; ++i, ++args_offset) {
+                switch (shorty_[i]) {
+                    case 'Z':
+                        writer->PutValue(JniTraceField::kBoolean, args[args_offset].z);
+                        break;
+                    case 'B':
+                        writer->PutValue(JniTraceField::kByte, args[args_offset].b);
+                        break;
+                    case 'C':
+                        writer->PutValue(JniTraceField::kChar, args[args_offset].c);
+                        break;
+                    case 'S':
+                        writer->PutValue(JniTraceField::kShort, args[args_offset].s);
+                        break;
+                    case 'I':
+                        writer->PutValue(JniTraceField::kInt, args[args_offset].i);
+                        break;
+                    case 'F':
+                        writer->PutValue(JniTraceField::kFloat, args[args_offset].f);
+                        break;
+                    case 'L':
+                        RecordObject(soa, args[args_offset].l, writer);
+                        break;
+                    case 'D':
+                        writer->PutValue(JniTraceField::kDouble, args[args_offset].d);
+                        break;
+                    case 'J':
+                        writer->PutValue(JniTraceField::kLong, args[args_offset].j);
+                        break;
+                }
+            }
+    }
+
+    // Records a reference as its class descriptor and identity hash, with the bounded contents
+    // of a java.lang.String and the length and leading bytes of an array. Nothing is allocated
+    // unless the class is a proxy.
+    static void RecordObject(const ScopedObjectAccessAlreadyRunnable& soa,
+                             jobject obj,
+                             JniTracePayloadWriter* writer)
+    REQUIRES_SHARED(Locks::mutator_lock_) {
+            ObjPtr<mirror::Object> receiver =soa.Decode<mirror::Object>(obj);
+            if(receiver==nullptr){
+                writer->PutTag(JniTraceField::kNull);
+                return;
+            }
+            if (receiver->IsString()){
+                ObjPtr<mirror::String> str = receiver->AsString();
+                writer->BeginField(JniTraceField::kJavaString);
+                if (str->IsCompressed()) {
+                    writer->PutRawString(reinterpret_cast<const char*>(str->GetValueCompressed()),
+                                         std::min<size_t>(str->GetLength(), kJniTraceMaxString));
+                } else {
+                    writer->PutRawUtf16String(str->GetValue(), str->GetLength());
+                }
+            }else{
+                char descriptor[kJniTraceMaxString];
+                const size_t descriptor_length =
+                        TraceDescriptor(receiver->GetClass(), descriptor, sizeof(descriptor));
+                if (receiver->IsArrayInstance()) {
+                    ObjPtr<mirror::Array> array = receiver->AsArray();
+                    ObjPtr<mirror::Class> component = receiver->GetClass()->GetComponentType();
+                    const int32_t length = array->GetLength();
+                    writer->BeginField(JniTraceField::kArray);
+                    writer->PutRawString(descriptor, descriptor_length);
+                    writer->PutRaw(length);
+                    if (component->IsPrimitive()) {
+                        const size_t shift = component->GetPrimitiveTypeSizeShift();
+                        const size_t bytes = std::min<size_t>(static_cast<size_t>(length) << shift,
+                                                              kJniTraceMaxArrayPrefix);
+                        writer->PutRawString(
+                                reinterpret_cast<const char*>(array->GetRawData(1u << shift, 0)),
+                                bytes);
+                    } else {
+                        writer->PutRawString("", 0u);
+                    }
+                } else {
+                    writer->BeginField(JniTraceField::kObject);
+                    writer->PutRawString(descriptor, descriptor_length);
+                }
+            }
+            // Last, like System.identityHashCode this may inflate a thin lock and suspend.
+            writer->PutRaw(static_cast<uint32_t>(receiver->IdentityHashCode()));
+            writer->EndField();
+    }
+
+    // Writes the descriptor of `klass` into `buf` without allocating for array classes.
+    static size_t TraceDescriptor(ObjPtr<mirror::Class> klass, char* buf, size_t size)
+    REQUIRES_SHARED(Locks::mutator_lock_) {
+            size_t length = 0;
+            while (klass->IsArrayClass()) {
+                if (length < size) {
+                    buf[length++] = '[';
+                }
+                klass = klass->GetComponentType();
+            }
+            std::string storage;
+            const char* element = klass->GetDescriptor(&storage);
+            const size_t element_length = std::min(strlen(element), size - length);
+            memcpy(buf + length, element, element_length);
+            return length + element_length;
     }
 
   static void ThrowIllegalPrimitiveArgumentException(const char* expected,
@@ -411,6 +610,8 @@ class ArgArray {
   std::unique_ptr<uint32_t[]> large_arg_array_;
 };
 
+#undef VARARGS_SPECIALIZED_PARAMS
+
 void CheckMethodArguments(JavaVMExt* vm, ArtMethod* m, uint32_t* args)
     REQUIRES_SHARED(Locks::mutator_lock_) {
   const dex::TypeList* params = m->GetParameterTypeList();
@@ -829,46 +1030,35 @@ jobject InvokeMethod<PointerSize::k64>(const ScopedObjectAccessAlreadyRunnable&
                                        size_t num_frames);
 
 bool HasShow(){
-    Runtime* runtime=Runtime::Current();
-    if(!runtime->GetConfigItem().isJNIMethodPrint ||!runtime->GetConfigItem().jniEnable){
-        return false;
-    }
-    return true;
+    // The depth is only raised while isJNIMethodPrint is set, see JniMethodStart.
+    return JniTrace::IsTracingCurrentThread();
 }
 
-typedef const char* (*kbacktraceFunc)(bool,const char*);
-
-const char* getBacktrace(const char* moduleName){
-    Runtime* runtime=Runtime::Current();
-    if(runtime->GetConfigItem().kbacktrace== nullptr){
-        ALOGD("jnitrace kbacktrace is null");
-        return nullptr;
-    }
-    kbacktraceFunc kbacktrace=(kbacktraceFunc)runtime->GetConfigItem().kbacktrace;
-    return kbacktrace(true,moduleName);
+static void RecordBacktrace(JniTracePayloadWriter* writer){
+    JniTrace::RecordBacktrace(JniTrace::CurrentThreadState(),writer);
 }
 
-
 void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,const char* funcname,jclass java_class, const char* name, const char* sig,jmethodID methodID){
     if(!HasShow()){
         return;
     }
-    ObjPtr<mirror::Class> c = soa.Decode<mirror::Class>(java_class);
-    std::string temp;
-    const char* className= c->GetDescriptor(&temp);
-    ArtMethod* method = jni::DecodeArtMethod(methodID);
-    pid_t pid = getpid();
-    ALOGD("%s           /* TID %d */","jnitrace",pid);
-    ALOGD("%s           [+] JNIEnv->%s","jnitrace",funcname);
-    ALOGD("%s           |- jclass           :%s","jnitrace",className);
-    ALOGD("%s           |- char*            :%p","jnitrace",name);
-    ALOGD("%s           |:     %s","jnitrace",name);
-    ALOGD("%s           |- char*            :%p","jnitrace",sig);
-    ALOGD("%s           |:     %s","jnitrace",sig);
-    ALOGD("%s           |= jmethodID        :0x%x   {%s}","jnitrace",method->GetMethodIndex(),method->PrettyMethod().c_str());
-    Runtime* runtime=Runtime::Current();
-    const char* backtrace= getBacktrace(runtime->GetConfigItem().jniModuleName);
-    ALOGD("---------------------Backtrace-------------------------\n%s\n",backtrace);
+    JniTraceThreadState* state=JniTrace::CurrentThreadState();
+    ArtMethod* method = methodID==nullptr ? nullptr : jni::DecodeArtMethod(methodID);
+    JniTraceRecord* record=JniTrace::BeginRecord(state,JniTraceEvent::kGetMethodID,funcname,
+                                                 reinterpret_cast<uint64_t>(method));
+    if(record==nullptr){
+        return;
+    }
+    JniTracePayloadWriter writer(record);
+    if(JniTrace::RecordsArguments(state)){
+        ObjPtr<mirror::Class> c = soa.Decode<mirror::Class>(java_class);
+        std::string temp;
+        writer.PutCString(JniTraceField::kString,c->GetDescriptor(&temp));
+        writer.PutCString(JniTraceField::kString,name);
+        writer.PutCString(JniTraceField::kString,sig);
+        RecordBacktrace(&writer);
+    }
+    JniTrace::EndRecord(state,record,writer);
 }
 
 void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& ,
@@ -877,13 +1067,17 @@ void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& ,
     if(!HasShow()){
         return;
     }
-    pid_t pid = getpid();
-    ALOGD("%s           /* TID %d */","jnitrace",pid);
-    ALOGD("%s           [+] JNIEnv->%s","jnitrace",funcname);
-    ALOGD("%s           |- char*        : %s","jnitrace",data);
-    Runtime* runtime=Runtime::Current();
-    const char* backtrace= getBacktrace(runtime->GetConfigItem().jniModuleName);
-    ALOGD("-----------------------Backtrace-------------------------\n%s\n",backtrace);
+    JniTraceThreadState* state=JniTrace::CurrentThreadState();
+    JniTraceRecord* record=JniTrace::BeginRecord(state,JniTraceEvent::kNewStringUTF,funcname,0);
+    if(record==nullptr){
+        return;
+    }
+    JniTracePayloadWriter writer(record);
+    if(JniTrace::RecordsArguments(state)){
+        writer.PutCString(JniTraceField::kString,data);
+        RecordBacktrace(&writer);
+    }
+    JniTrace::EndRecord(state,record,writer);
 }
 
 void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& ,
@@ -893,21 +1087,73 @@ void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& ,
     if(!HasShow()){
         return;
     }
-
-    pid_t pid = getpid();
-    ALOGD("%s           /* TID %d */","jnitrace",pid);
-    ALOGD("%s           [+] JNIEnv->%s","jnitrace",funcname);
-    if(is_copy== nullptr){
-        ALOGD("%s           |- jboolean*        : %d","jnitrace",false);
-    }else{
-        ALOGD("%s           |- jboolean*        : %d","jnitrace",*is_copy);
+    JniTraceThreadState* state=JniTrace::CurrentThreadState();
+    JniTraceRecord* record=JniTrace::BeginRecord(state,JniTraceEvent::kGetStringUTFChars,funcname,0);
+    if(record==nullptr){
+        return;
     }
-    ALOGD("%s           |= char*            : %s","jnitrace",data);
-    Runtime* runtime=Runtime::Current();
-    const char* backtrace= getBacktrace(runtime->GetConfigItem().jniModuleName);
-    ALOGD("-----------------------Backtrace-------------------------\n%s\n",backtrace);
+    JniTracePayloadWriter writer(record);
+    if(JniTrace::RecordsArguments(state)){
+        writer.PutValue(JniTraceField::kBoolean,static_cast<jboolean>(is_copy==nullptr ? JNI_FALSE : *is_copy));
+        writer.PutCString(JniTraceField::kString,data);
+        RecordBacktrace(&writer);
+    }
+    JniTrace::EndRecord(state,record,writer);
 }
 
+static void RecordCallArgs(const ScopedObjectAccessAlreadyRunnable& soa,
+                           ArtMethod* method,
+                           va_list vaList,
+                           JniTracePayloadWriter* writer)
+    REQUIRES_SHARED(Locks::mutator_lock_) {
+    uint32_t shorty_len = 0;
+    const char* shorty =
+            method->GetInterfaceMethodIfProxy(kRuntimePointerSize)->GetShorty(&shorty_len);
+    ArgArray arg_array(shorty, shorty_len);
+    arg_array.VarArgsRecordArg(soa, vaList, writer);
+}
+
+static void RecordCallArgs(const ScopedObjectAccessAlreadyRunnable& soa,
+                           ArtMethod* method,
+                           const jvalue* args,
+                           JniTracePayloadWriter* writer)
+    REQUIRES_SHARED(Locks::mutator_lock_) {
+    uint32_t shorty_len = 0;
+    const char* shorty =
+            method->GetInterfaceMethodIfProxy(kRuntimePointerSize)->GetShorty(&shorty_len);
+    ArgArray arg_array(shorty, shorty_len);
+    arg_array.JValuesRecordArg(soa, args, writer);
+}
+
+// Shared by the va_list and jvalue flavours of the Call*Method hooks.
+template <typename ArgsType>
+static void RecordMethodCall(const ScopedObjectAccessAlreadyRunnable& soa,
+                             const char* funcname,
+                             jmethodID mid,
+                             ArgsType args,
+                             const jobject* ret)
+    REQUIRES_SHARED(Locks::mutator_lock_) {
+    JniTraceThreadState* state=JniTrace::CurrentThreadState();
+    ArtMethod* method = jni::DecodeArtMethod(mid);
+    JniTraceEvent event = ret==nullptr ? JniTraceEvent::kCallMethod : JniTraceEvent::kCallMethodResult;
+    JniTraceRecord* record=JniTrace::BeginRecord(state,event,funcname,
+                                                 reinterpret_cast<uint64_t>(method));
+    if(record==nullptr){
+        return;
+    }
+    JniTracePayloadWriter writer(record);
+    if(!JniTrace::RecordsArguments(state)){
+        JniTrace::EndRecord(state,record,writer);
+        return;
+    }
+    RecordCallArgs(soa,method,args,&writer);
+    if(ret!=nullptr){
+        writer.PutTag(JniTraceField::kResult);
+        ArgArray::RecordObject(soa,*ret,&writer);
+        RecordBacktrace(&writer);
+    }
+    JniTrace::EndRecord(state,record,writer);
+}
 
 void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,
                  const char* funcname,
@@ -916,19 +1162,7 @@ void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,
     if(!HasShow()){
         return;
     }
-
-    ArtMethod* method = jni::DecodeArtMethod(mid);
-    pid_t pid = getpid();
-    ALOGD("%s           /* TID %d */","jnitrace",pid);
-    ALOGD("%s           [+] JNIEnv->%s","jnitrace",funcname);
-    ALOGD("%s           |- jmethodID        :0x%x   {%s}","jnitrace",method->GetMethodIndex(),method->PrettyMethod().c_str());
-    ALOGD("%s           |- va_list          :%p","jnitrace",&vaList);
-
-    uint32_t shorty_len = 0;
-    const char* shorty =
-            method->GetInterfaceMethodIfProxy(kRuntimePointerSize)->GetShorty(&shorty_len);
-    ArgArray arg_array(shorty, shorty_len);
-    arg_array.VarArgsShowArg(soa, vaList);
+    RecordMethodCall(soa,funcname,mid,vaList,nullptr);
 }
 
 
@@ -940,24 +1174,28 @@ void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,
     if(!HasShow()){
         return;
     }
-    ShowVarArgs(soa,funcname,mid,valist);
+    RecordMethodCall(soa,funcname,mid,valist,&ret);
+}
 
-    ObjPtr<mirror::Object> receiver =soa.Decode<mirror::Object>(ret);
-    if(receiver==nullptr){
+void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,
+                 const char* funcname,
+                 jmethodID mid,
+                 const jvalue* args){
+    if(!HasShow()){
         return;
     }
-    ObjPtr<mirror::Class> cls=receiver->GetClass();
-    if (cls->DescriptorEquals("Ljava/lang/String;")){
-        ObjPtr<mirror::String> retStr =soa.Decode<mirror::String>(ret);
-        ALOGD("%s           |= jstring          :%s","jnitrace",(const char*)retStr->GetValue());
-    }else{
-        std::string temp;
-        const char* className= cls->GetDescriptor(&temp);
-        ALOGD("%s           |= jobject          :%p   {%s}","jnitrace",&ret,className);
+    RecordMethodCall(soa,funcname,mid,args,nullptr);
+}
+
+void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,
+                 const char* funcname,
+                 jmethodID mid,
+                 const jvalue* args,
+                 jobject ret){
+    if(!HasShow()){
+        return;
     }
-    Runtime* runtime=Runtime::Current();
-    const char* backtrace= getBacktrace(runtime->GetConfigItem().jniModuleName);
-    ALOGD("----------------------Backtrace-------------------------\n%s\n",backtrace);
+    RecordMethodCall(soa,funcname,mid,args,&ret);
 }
 
 void InvokeConstructor(const ScopedObjectAccessAlreadyRunnable& soa,
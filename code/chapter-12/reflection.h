@@ -134,6 +134,19 @@ void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,
                  jobject ret)
 REQUIRES_SHARED(Locks::mutator_lock_);
 
+void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,
+                 const char* funcname,
+                 jmethodID mid,
+                 const jvalue* args)
+    REQUIRES_SHARED(Locks::mutator_lock_);
+
+void ShowVarArgs(const ScopedObjectAccessAlreadyRunnable& soa,
+                 const char* funcname,
+                 jmethodID mid,
+                 const jvalue* args,
+                 jobject ret)
+    REQUIRES_SHARED(Locks::mutator_lock_);
+
 
 
 // Special-casing of the above. Assumes that the method is the correct constructor, the class is
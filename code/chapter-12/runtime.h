@@ -42,6 +42,7 @@
 #include "jdwp_provider.h"
 #include "jni/jni_id_manager.h"
 #include "jni_id_type.h"
+#include "jni_trace.h"
 #include "metrics/reporter.h"
 #include "obj_ptr.h"
 #include "offsets.h"
@@ -116,16 +117,6 @@ class Transaction;
 
 typedef std::vector<std::pair<std::string, const void*>> RuntimeOptions;
 
-typedef struct{
-    char packageName[128];
-    char jniModuleName[128];
-    char jniFuncName[128];
-    bool isRegisterNativePrint;
-    bool isJNIMethodPrint;
-    bool jniEnable;
-    void* kbacktrace=nullptr;
-}PackageItem;
-
 class Runtime {
  public:
   // Parse raw runtime options.
@@ -261,13 +252,30 @@ class Runtime {
     return instance_;
   }
 
-  void SetConfigItem(PackageItem item){
-      configItem=item;
+  void SetConfigItem(const PackageItem& item){
+      // add
+      JniTraceConfig::Publish(item);
+      //endadd
+  }
+
+  // add
+  // Value of -Xjnitrace[:<spec>]. Runtime::Init passes RuntimeArgumentMap::JniTrace here next to
+  // the TraceConfig setup; the config is published once the main thread is attached.
+  bool SetJniTraceOptions(const std::string& spec, std::string* error_msg){
+      PackageItem item;
+      if(!JniTraceConfig::ParseOptions(spec, &item, error_msg)){
+          return false;
+      }
+      JniTraceConfig::SetLaunchOptions(item);
+      return true;
   }
 
-  PackageItem& GetConfigItem(){
-      return configItem;
+  // Pins the current config until the end of the full expression, or of the scope it is
+  // stored in. See JniTraceConfigScope.
+  JniTraceConfigScope GetConfigItem(){
+      return JniTraceConfigScope();
   }
+  //endadd
 
   // Aborts semi-cleanly. Used in the implementation of LOG(FATAL), which most
   // callers should prefer.
@@ -673,6 +681,10 @@ class Runtime {
       process_package_name_.clear();
     } else {
       process_package_name_ = package_name;
+      // add
+      // Called while binding the application, before any of its code runs.
+      JniTraceConfig::LoadForPackage(process_package_name_);
+      //endadd
     }
   }
 
@@ -1112,12 +1124,6 @@ class Runtime {
 
   static constexpr uint32_t kCalleeSaveSize = 6u;
 
-  PackageItem configItem;
-
-  typedef const char* (*kbacktraceFunc)(bool with_context,const char* moduleName);
-
-  kbacktraceFunc kbacktrace=nullptr;
-
     // 64 bit so that we can share the same asm offsets for both 32 and 64 bits.
   uint64_t callee_save_methods_[kCalleeSaveSize];
   // Pre-allocated exceptions (see Runtime::Init).